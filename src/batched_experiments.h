@@ -0,0 +1,289 @@
+/* Runs of the Two-Choice process in the b-Batched setting over a range of
+   batch sizes, which produce Table 12.4 and Figure 12.2. */
+#ifndef NOISE22_BATCHED_EXPERIMENTS_H_
+#define NOISE22_BATCHED_EXPERIMENTS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batched_setting.h"
+#include "horizons.h"
+#include "journal.h"
+#include "latex.h"
+#include "load_store.h"
+#include "progress.h"
+#include "result_cache.h"
+#include "result_sink.h"
+#include "run_store.h"
+#include "scheduler.h"
+#include "seeding.h"
+#include "sharding.h"
+#include "stationary.h"
+#include "statistics.h"
+#include "trajectory.h"
+
+/* Batch sizes of Figure 12.2 and Table 12.4. */
+const std::vector<int> kBatchSizes({ 5, 10, 50, 100, 500, 1'000, 5'000, 10'000, 50'000, 100'000, 500'000 });
+
+/* Options for the experiments in `batched_experiments`. */
+struct BatchedOptions {
+  /* Batch sizes to run the experiments for. */
+  std::vector<int> batch_sizes = kBatchSizes;
+
+  /* Number of balls m of each run as a multiple of n, where 0 means 1000 n
+     for batch sizes b >= n and 50 n otherwise (as in the paper). */
+  uint64_t balls_factor = 0;
+
+  /* Whether each run ends as soon as the `BurnInDetector` declares it mixed
+     (checking roughly every n/4 balls), instead of after m balls. */
+  bool detect_burn_in = false;
+
+  /* Rule deciding the number of runs for each batch size, which is applied
+     to the Two-Choice gaps. */
+  SequentialStopping stopping;
+
+  /* If not empty, the warm-up of each single-trajectory configuration is
+     resumed from (and saved to) a checkpoint in this directory. */
+  std::string checkpoint_dir;
+
+  /* Seed from which the seeds of the runs are derived. */
+  uint64_t seed = 0;
+
+  /* If not null, completed runs are appended to this journal and runs that
+     are already in it are not repeated. */
+  Journal* journal = nullptr;
+
+  /* If not null, runs are looked up in (and added to) this cache, so only
+     the runs missing from it are computed. */
+  ResultCache* cache = nullptr;
+
+  /* If not null, the gap distribution of every configuration is written to
+     this sink. */
+  ResultSink* results = nullptr;
+
+  /* If not empty, the trajectory of the first run for each batch size is
+     recorded (when it is simulated) to a file in this directory, sampled
+     as given by `recorder` (where an interval of 0 means n balls). */
+  std::string trajectory_dir;
+  RecorderOptions recorder;
+
+  /* Numbers of balls (as multiples of n, rounded down to whole batches) at
+     which the Two-Choice gap is measured within each run. If empty, it is
+     only measured after m balls. Burn-in detection only applies to a
+     single horizon. */
+  std::vector<long long> horizons;
+
+  /* If not null, the progress of the runs is reported to it. */
+  ProgressReporter* progress = nullptr;
+
+  /* Part of the runs computed by this process. */
+  Shard shard;
+
+  /* Stream the tables are printed to. */
+  std::ostream* out = &std::cout;
+};
+
+/* Returns m / n for the batch size. */
+inline uint64_t batched_factor(const BatchedOptions& options, uint64_t num_bins, int batch_size) {
+  if (options.balls_factor > 0) return options.balls_factor;
+  return uint64_t(batch_size) >= num_bins ? 1'000 : 50;
+}
+
+/* Mean gaps of a batch size, as plotted in Figure 12.2. */
+struct BatchedMeans {
+  double one_choice;
+  double two_choice;
+};
+
+/* Runs the experiments for one batch size and prints its entry of Table
+   12.4, returning nothing if interrupted. */
+template<typename Generator = std::mt19937_64>
+std::optional<BatchedMeans> batched_configuration(uint64_t num_bins, int batch_size, const BatchedOptions& options) {
+  std::ostream& out = *options.out;
+  bool sequential = options.stopping.precision > 0.0;
+  out << "Batch-size (b) : " << batch_size << "\n";
+  uint64_t factor = batched_factor(options, num_bins, batch_size);
+  // Horizons in rounds, where the first round is always run.
+  std::vector<uint64_t> horizons;
+  for (auto balls : horizons_in_balls(options.horizons, factor, num_bins)) {
+    uint64_t rounds = std::max<uint64_t>(1, balls / batch_size);
+    if (horizons.empty() || horizons.back() != rounds) horizons.push_back(rounds);
+  }
+  bool detect_burn_in = options.detect_burn_in && horizons.size() == 1;
+  std::string variant = detect_burn_in ? "detect-burn-in" : "";
+  RunStore store(options.journal, options.cache);
+  // The setting of the previous simulated run, which is reset and reused.
+  std::optional<BatchedTwoChoiceSetting> pooled;
+  // Sum of the mixing points of the simulated runs (the runs served from the
+  // journal or cache have none).
+  double mixing_sum = 0.0;
+  size_t mixing_runs = 0;
+  GapStatistics one_choice_statistics;
+  std::vector<GapStatistics> horizon_statistics(horizons.size());
+  for (uint64_t run = 0; !options.shard.shouldStop(options.stopping, run, horizon_statistics.back()); ++run) {
+    if (interrupted()) return std::nullopt;
+    uint64_t seed = derive_seed(options.seed, { uint64_t(num_bins), uint64_t(batch_size), run });
+    if (!options.shard.owns(seed)) continue;
+    std::vector<Measurement> measurements({ { "batched-one-choice", { "batched", "one-choice", batch_size, uint64_t(num_bins),
+      uint64_t(batch_size), uint64_t(batch_size), generator_name<Generator>(), options.seed, variant } } });
+    for (auto rounds : horizons) {
+      measurements.push_back({ "batched-two-choice", { "batched", "two-choice", batch_size, uint64_t(num_bins),
+        rounds * batch_size, uint64_t(batch_size), generator_name<Generator>(), options.seed, variant } });
+    }
+    std::vector<int> gaps;
+    if (!store.lookup(measurements, run, seed, gaps)) {
+      Generator generator(seed);
+      if (pooled.has_value()) {
+        pooled->reset();
+      } else {
+        pooled.emplace(num_bins, batch_size);
+      }
+      BatchedTwoChoiceSetting& batched_two_choice = *pooled;
+      batched_two_choice.nextRound(generator);
+      gaps.push_back(batched_two_choice.getGapCeiling());
+      if (detect_burn_in) {
+        uint64_t check_interval = std::max<uint64_t>(1, num_bins / 4 / batch_size);
+        BurnInResult result = burn_in(batched_two_choice, generator, check_interval, horizons[0] - 1);
+        mixing_sum += (result.mixing_rounds + 1) * double(batch_size);
+        ++mixing_runs;
+        gaps.push_back(batched_two_choice.getGapCeiling());
+      } else {
+        std::unique_ptr<TrajectoryRecorder> recorder;
+        if (run == 0 && !options.trajectory_dir.empty()) {
+          RecorderOptions recorder_options = options.recorder;
+          if (recorder_options.interval == 0) recorder_options.interval = num_bins;
+          recorder = std::make_unique<TrajectoryRecorder>(options.trajectory_dir + "/batched_n" + std::to_string(num_bins)
+            + "_b" + std::to_string(batch_size) + ".traj", num_bins, recorder_options);
+          recorder->record(batched_two_choice);
+        }
+        std::vector<uint64_t> remaining;
+        for (auto rounds : horizons) {
+          remaining.push_back(rounds - 1);
+        }
+        if (options.progress != nullptr) {
+          options.progress->start("b = " + std::to_string(batch_size) + " (n = " + std::to_string(num_bins) + ", run "
+            + std::to_string(run) + ")", horizons.back() * batch_size);
+        }
+        run_to_horizons(batched_two_choice, generator, remaining, [&gaps](size_t, const BatchedTwoChoiceSetting& process) {
+          gaps.push_back(process.getGapCeiling());
+        }, recorder.get(), options.progress);
+      }
+    }
+    store.record(measurements, run, seed, gaps);
+    one_choice_statistics.add(gaps[0]);
+    for (size_t i = 0; i < horizons.size(); ++i) {
+      horizon_statistics[i].add(gaps[i + 1]);
+    }
+  }
+  const GapStatistics& two_choice_statistics = horizon_statistics.back();
+  size_t runs = two_choice_statistics.getCount();
+  write_gap_distribution(options.results, "batched-one-choice", batch_size, num_bins, batch_size, one_choice_statistics);
+  for (size_t i = 0; i < horizons.size(); ++i) {
+    write_gap_distribution(options.results, "batched-two-choice", batch_size, num_bins, horizons[i] * batch_size, horizon_statistics[i]);
+  }
+  if (options.detect_burn_in) {
+    print_mixing_point(mixing_sum, mixing_runs, out);
+  }
+  if (sequential) {
+    out << "Runs : " << runs << "\n";
+  }
+  std::vector<uint64_t> horizon_balls;
+  for (auto rounds : horizons) {
+    horizon_balls.push_back(rounds * batch_size);
+  }
+  print_batched_entry(horizon_balls, horizon_statistics, one_choice_statistics, sequential, out);
+  return BatchedMeans{ one_choice_statistics.getMean(), two_choice_statistics.getMean() };
+}
+
+/* Prints Figure 12.2 from the mean gaps of the batch sizes. */
+inline void print_batched_figure(const std::vector<int>& batch_sizes, const std::vector<BatchedMeans>& means, std::ostream& out) {
+  std::vector<std::pair<int, int>> one_choice_plot, two_choice_plot;
+  for (size_t i = 0; i < means.size(); ++i) {
+    one_choice_plot.push_back({ batch_sizes[i], means[i].one_choice });
+    two_choice_plot.push_back({ batch_sizes[i], means[i].two_choice });
+  }
+  print_batched_figure(one_choice_plot, two_choice_plot, out);
+}
+
+template<typename Generator = std::mt19937_64>
+void batched_experiments(uint64_t num_bins, const BatchedOptions& options = BatchedOptions()) {
+  std::vector<BatchedMeans> means;
+  *options.out << "=== Table 12.4 ===\n";
+  for (auto batch_size : options.batch_sizes) {
+    std::optional<BatchedMeans> result = batched_configuration<Generator>(num_bins, batch_size, options);
+    if (!result.has_value()) return;
+    means.push_back(*result);
+  }
+  print_batched_figure(options.batch_sizes, means, *options.out);
+}
+
+/* Returns the estimated memory and time of the experiments for one batch
+   size. */
+inline JobEstimate estimate_batched_configuration(const CostModel& model, uint64_t num_bins, int batch_size, const BatchedOptions& options) {
+  uint64_t factor = batched_factor(options, num_bins, batch_size);
+  uint64_t balls = options.stopping.max_runs * horizons_in_balls(options.horizons, factor, num_bins).back();
+  return model.estimateBatched(num_bins, batch_size, balls, default_page_mode() == PageMode::kFile);
+}
+
+/* Runs the experiments with one job per number of bins and batch size,
+   scheduled on `threads` threads within `memory_budget` bytes, and prints
+   their output in the same order as `batched_experiments`. */
+template<typename Generator = std::mt19937_64>
+void scheduled_batched_experiments(const std::vector<long long>& bins, const BatchedOptions& options, size_t threads, uint64_t memory_budget) {
+  CostModel model;
+  SweepScheduler scheduler(threads, memory_budget);
+  const std::vector<int>& batch_sizes = options.batch_sizes;
+  size_t jobs = bins.size() * batch_sizes.size();
+  std::vector<std::ostringstream> outputs(jobs);
+  std::vector<std::optional<BatchedMeans>> means(jobs);
+  for (size_t i = 0; i < bins.size(); ++i) {
+    for (size_t j = 0; j < batch_sizes.size(); ++j) {
+      size_t job = i * batch_sizes.size() + j;
+      BatchedOptions job_options = options;
+      job_options.out = &outputs[job];
+      // Progress reports of concurrent runs would interleave.
+      job_options.progress = nullptr;
+      uint64_t num_bins = bins[i];
+      int batch_size = batch_sizes[j];
+      scheduler.add({ "b = " + std::to_string(batch_size) + " (n = " + std::to_string(num_bins) + ")",
+                      estimate_batched_configuration(model, num_bins, batch_size, options),
+                      [=, &means]() { means[job] = batched_configuration<Generator>(num_bins, batch_size, job_options); } });
+    }
+  }
+  print_schedule_plan(scheduler, std::cerr);
+  scheduler.run();
+  if (interrupted()) return;
+  for (size_t i = 0; i < bins.size(); ++i) {
+    std::vector<BatchedMeans> bin_means;
+    *options.out << "=== Table 12.4 ===\n";
+    for (size_t j = 0; j < batch_sizes.size(); ++j) {
+      *options.out << outputs[i * batch_sizes.size() + j].str();
+      bin_means.push_back(*means[i * batch_sizes.size() + j]);
+    }
+    print_batched_figure(batch_sizes, bin_means, *options.out);
+  }
+}
+
+/* Runs the experiments for each number of bins one after the other, or
+   scheduled on `threads` threads within `memory_budget` bytes if there are
+   several threads. */
+template<typename Generator = std::mt19937_64>
+void run_batched_experiments(const std::vector<long long>& bins, const BatchedOptions& options, size_t threads, uint64_t memory_budget) {
+  if (threads > 1) {
+    scheduled_batched_experiments<Generator>(bins, options, threads, memory_budget);
+    return;
+  }
+  for (auto num_bins : bins) {
+    if (interrupted()) return;
+    batched_experiments<Generator>(num_bins, options);
+  }
+}
+
+#endif  // NOISE22_BATCHED_EXPERIMENTS_H_
@@ -3,146 +3,235 @@
       by Dimitrios Los and Thomas Sauerwald (PODC'22)
       [https://arxiv.org/abs/2302.04399]. */
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <optional>
 #include <random>
-
-/* Runs the Two-Choice process in the b-Batched setting. This process was
-   introduced in
-     "Multiple-choice balanced allocation in (almost) parallel", 
-         by Berenbrink, Czumaj, Englert, Friedetzky, and Nagel (2012)
-         [https://arxiv.org/abs/1501.04822].
-   
-   It starts from an empty load vector and in each round:
-     - Allocates b (potentially weighted) balls using the process provided,
-       with the load information at the beginning of the batch.
-   
-   This class keeps track of the load-vector, the maximum load and gap.
-   */
-class BatchedTwoChoiceSetting {
-public:
-
-  /* Initializes b-Batched setting for the given number of bins 
-     and batch size. */
-  BatchedTwoChoiceSetting(size_t num_bins, size_t batch_size)    
-    : load_vector_(num_bins, 0), buffer_vector_(num_bins, 0), uar_(0, num_bins - 1), batch_size_(batch_size), max_load_(0), total_balls_(0) {
-    
-  }
-  
-  /* Performs an allocation of a batch. */
-  template<typename Generator>
-  void nextRound(Generator& generator) {
-    // Phase 1: Perform b allocations.
-    size_t n = load_vector_.size();
-    
-    for (size_t i = 0; i < batch_size_; ++i) {
-      size_t i1 = uar_(generator), i2 = uar_(generator);
-      // Break ties randomly. 
-      size_t idx = load_vector_[i1] <= load_vector_[i2] ? i1 : i2;
-      ++buffer_vector_[idx];
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "batched_experiments.h"
+#include "batched_setting.h"
+#include "checkpoint.h"
+#include "flags.h"
+#include "horizons.h"
+#include "journal.h"
+#include "latex.h"
+#include "load_store.h"
+#include "load_view.h"
+#include "progress.h"
+#include "result_cache.h"
+#include "result_sink.h"
+#include "run_store.h"
+#include "scheduler.h"
+#include "seeding.h"
+#include "sharding.h"
+#include "snapshot.h"
+#include "splitting.h"
+#include "stationary.h"
+#include "statistics.h"
+#include "trace.h"
+#include "trajectory.h"
+
+/* Estimates, for each batch size, the probability that the (rounded up) gap
+   is at least `target_gap` after n more balls (rounded up to a batch) from
+   a stationary state, using multilevel splitting with one level for each
+   integer gap. The estimate is averaged over `starts` stationary states, as
+   many balls apart as the warm-up (with one start, it is conditional on the
+   state after the warm-up). With `naive_runs` > 0, a naive Monte Carlo
+   estimate from the same states is printed as well, for checking. */
+void batched_tail_probabilities(uint64_t num_bins, int target_gap, const BatchedOptions& options, size_t trajectories_per_level,
+                                size_t starts, size_t naive_runs) {
+  std::mt19937_64 generator(options.seed);
+
+  for (auto batch_size : options.batch_sizes) {
+    std::cout << "Batch-size (b) : " << batch_size << "\n";
+    uint64_t factor = batched_factor(options, num_bins, batch_size);
+    uint64_t num_rounds = factor * num_bins / batch_size;
+    BatchedTwoChoiceSetting batched_two_choice(num_bins, batch_size);
+    std::string path = options.checkpoint_dir.empty() ? "" : options.checkpoint_dir + "/" + checkpoint_file_name(
+      "batched_n" + std::to_string(num_bins) + "_b" + std::to_string(batch_size), num_rounds * batch_size,
+      generator_name<std::mt19937_64>(), options.seed, options.detect_burn_in);
+    if (!path.empty() && (checkpoint_exists(path) || !options.detect_burn_in)) {
+      checkpointed_warm_up(batched_two_choice, generator, path, num_rounds * batch_size, 0);
+    } else if (options.detect_burn_in) {
+      BurnInResult result = burn_in(batched_two_choice, generator, std::max<uint64_t>(1, num_bins / 4 / batch_size), num_rounds);
+      if (!path.empty()) {
+        batched_two_choice.saveCheckpoint(path, generator, result);
+      }
+    } else {
+      if (options.progress != nullptr) {
+        options.progress->start("Warm-up (b = " + std::to_string(batch_size) + ")", num_rounds * batch_size);
+      }
+      run_with_progress(batched_two_choice, generator, num_rounds, options.progress);
     }
-    total_balls_ += batch_size_;
-
-    // Phase 2: Update and sort the load vector.
-    for (int i = 0; i < n; ++i) {
-      load_vector_[i] += buffer_vector_[i];
-      buffer_vector_[i] = 0;
-      max_load_ = std::max(max_load_, load_vector_[i]);
+    SplittingOptions splitting;
+    for (int level = int(batched_two_choice.getGapCeiling()) + 1; level <= target_gap; ++level) {
+      splitting.levels.push_back(level);
+    }
+    if (splitting.levels.empty()) {
+      splitting.levels.push_back(target_gap);
+    }
+    splitting.trajectories_per_level = trajectories_per_level;
+    splitting.horizon = (num_bins + batch_size - 1) / batch_size;
+    splitting.measure_at_horizon = true;
+    auto score = [](const BatchedTwoChoiceSetting& process) { return double(process.getGapCeiling()); };
+    std::vector<SplittingResult> estimates, naive_estimates;
+    for (size_t start = 0; start < starts; ++start) {
+      if (start > 0) run_with_progress(batched_two_choice, generator, num_rounds, nullptr);
+      estimates.push_back(estimate_exceedance(batched_two_choice, generator, splitting, score));
+      if (naive_runs > 0) {
+        naive_estimates.push_back(estimate_exceedance_naively(batched_two_choice, generator, splitting, score, naive_runs));
+      }
+    }
+    std::string event = "gap >= " + std::to_string(target_gap) + (starts == 1 ? " | warm-up state" : "");
+    SplittingResult result = average_estimates(estimates);
+    std::cout << "P(" << event << ") : " << result.probability
+              << " (relative error " << result.relative_error << ", " << result.rounds << " rounds)\n";
+    if (naive_runs > 0) {
+      SplittingResult naive = average_estimates(naive_estimates);
+      std::cout << "Naive P(" << event << ") : " << naive.probability
+                << " (relative error " << naive.relative_error << ", " << naive.rounds << " rounds)\n";
     }
-    // std::sort(load_vector_.begin(), load_vector_.end(), std::greater<size_t>());
   }
+}
 
-  /* Returns the current maximum load. */
-  double getMaxLoad() const {
-    return max_load_;
+/* Replays the trace with every batch size of the options (in parallel) and
+   prints the final gaps. */
+void batched_replay(const TraceReader& trace, const BatchedOptions& options) {
+  const std::vector<int>& batch_sizes = options.batch_sizes;
+  std::vector<BatchedTwoChoiceSetting> settings;
+  settings.reserve(batch_sizes.size());
+  for (auto batch_size : batch_sizes) {
+    settings.emplace_back(trace.getHeader().num_bins, batch_size);
   }
-
-  /* Returns the current gap. */
-  double getGap() const {
-    return max_load_ - total_balls_ / double(load_vector_.size());
+  replay_in_parallel<std::mt19937_64>(settings, trace);
+  for (size_t i = 0; i < batch_sizes.size(); ++i) {
+    std::cout << "Batch-size (b) : " << batch_sizes[i] << "\n";
+    std::cout << "Gap : " << settings[i].getGapCeiling() << " (" << settings[i].getTotalBalls() << " balls)\n";
   }
+}
 
-  /* Returns the current load vector. */
-  std::vector<size_t> getLoadVector() const {
-    return load_vector_;
+int main(int argc, char** argv) {
+  /* Flags:
+       --detect-burn-in  (end each run once the trajectory has mixed)
+       --precision=<target half-width of the interval of each gap entry>
+       --min-runs=<runs>, --max-runs=<runs>  (default: 100)
+       --checkpoint-dir=<directory>  (resume/warm-start single trajectories)
+       --seed=<base seed of the runs>  (default: 0)
+       --journal=<file>  (resume an interrupted sweep from its journal)
+       --cache=<directory>  (reuse the runs of earlier sweeps)
+       --results=<file.csv|file.jsonl|file>  (append the distributions)
+       --horizons=<h1>,<h2>,...  (measure after h1 n, h2 n, ... balls in each run)
+       --bins=<n1>,<n2>,...  (default: 10000)
+       --batch-sizes=<b1>,<b2>,...  (default: those of Table 12.4)
+       --pages=default|transparent|2m|1g  (huge pages for the load vectors)
+       --store-dir=<directory>  (keep the load vectors in files there, for n beyond the memory)
+       --progress  (report the progress of long runs to stderr)
+       --progress-period=<seconds between reports>  (default: 10)
+       --threads=<threads>  (run the batch sizes and numbers of bins in parallel)
+       --memory-budget=<GB for the load vectors of the parallel runs>  (default: 4)
+       --placement=none|compact|scatter|per-socket  (pin the parallel threads to NUMA nodes)
+       --record-dir=<directory>  (record the trajectory of the first run)
+       --record-interval=<balls between samples>  (default: n)
+       --record-growth=<factor>  (sample at logarithmically spaced points)
+       --record-levels=<number of levels below the maximum to count>
+       --shard=<k>/<K>  (only compute the runs of shard k of K, see sharding.h)
+     A trace of uniformly sampled bins can be written and then replayed with
+     every batch size:
+       --write-trace=<file> --trace-bins=<n> --trace-balls=<m>
+       --replay=<file>
+     Instead of the gap distributions, the tail probabilities P(gap >= k)
+     can be estimated with multilevel splitting:
+       --tail-gap=<k> --trajectories=<trajectories per level>  (default: 1000)
+       --starts=<stationary starting states, a warm-up apart>  (default: 1)
+       --naive-runs=<runs>  (also print a naive Monte Carlo estimate) */
+  Flags flags(argc, argv);
+  BatchedOptions options;
+  options.detect_burn_in = flags.has("detect-burn-in");
+  options.stopping.precision = flags.getDouble("precision", 0.0);
+  options.stopping.min_runs = flags.getInt("min-runs", 100);
+  options.stopping.max_runs = flags.getInt("max-runs", 100);
+  std::vector<long long> batch_sizes = flags.getIntList("batch-sizes");
+  if (!batch_sizes.empty()) options.batch_sizes.assign(batch_sizes.begin(), batch_sizes.end());
+  if (flags.has("shard")) {
+    options.shard = parse_shard(flags.getString("shard", "0/1"));
+    if (options.stopping.precision > 0.0) {
+      throw std::runtime_error("--shard needs a fixed number of runs");
+    }
+  }
+  options.checkpoint_dir = flags.getString("checkpoint-dir", "");
+  options.seed = flags.getInt("seed", 0);
+  options.horizons = flags.getIntList("horizons");
+  default_page_mode() = parse_page_mode(flags.getString("pages", "default"));
+  thread_placement() = parse_placement_policy(flags.getString("placement", "none"));
+  if (flags.has("store-dir")) {
+    store_directory() = flags.getString("store-dir", ".");
+    default_page_mode() = PageMode::kFile;
+  }
+  std::vector<long long> bins = flags.getIntList("bins");
+  if (bins.empty()) {
+    bins.push_back(10'000);
+  }
+  std::unique_ptr<ProgressReporter> progress;
+  if (flags.has("progress")) {
+    progress = std::make_unique<ProgressReporter>(flags.getDouble("progress-period", 10.0), flags.has("store-dir"));
+    options.progress = progress.get();
+  }
+  options.trajectory_dir = flags.getString("record-dir", "");
+  options.recorder.interval = flags.getInt("record-interval", 0);
+  if (flags.has("record-growth")) {
+    options.recorder.schedule = RecordSchedule::kLogarithmic;
+    options.recorder.growth = flags.getDouble("record-growth", 1.1);
+  }
+  options.recorder.levels = flags.getInt("record-levels", 0);
+  if (!options.trajectory_dir.empty()) {
+    std::filesystem::create_directories(options.trajectory_dir);
+  }
+  std::unique_ptr<Journal> journal;
+  if (flags.has("journal")) {
+    journal = std::make_unique<Journal>(flags.getString("journal", ""));
+    options.journal = journal.get();
+    install_interrupt_handlers();
+  }
+  std::unique_ptr<ResultSink> results;
+  if (flags.has("results")) {
+    results = make_result_sink(flags.getString("results", ""));
+    options.results = results.get();
+  }
+  std::unique_ptr<ResultCache> cache;
+  if (flags.has("cache")) {
+    cache = std::make_unique<ResultCache>(flags.getString("cache", ""));
+    options.cache = cache.get();
   }
 
-private:
-
-  /* Current load vector of the process. */
-  std::vector<size_t> load_vector_;
-
-  /* Buffer vector for the balls allocated in the current batch. */
-  std::vector<size_t> buffer_vector_;
-
-  /* Sample a bin uniformly at random. */
-  std::uniform_int<size_t> uar_;
-
-  /* Batch size used in the setting. */
-  const size_t batch_size_;
-
-  /* Current maximum load in the load vector. */
-  size_t max_load_;
-
-  /* Total number of balls in the load vector. */
-  size_t total_balls_;
-};
-
-
-void batched_experiments(int num_bins) {
-  std::mt19937_64 generator;
-
-  int runs = 100;
-  std::vector<int> batch_sizes({ 5, 10, 50, 100, 500, 1'000, 5'000, 10'000, 50'000, 100'000, 500'000 });
-  std::vector<std::pair<int, int>> one_choice_plot, two_choice_plot;
-  
-  std::cout << "=== Table 12.4 ===" << std::endl;
-  for (auto batch_size : batch_sizes) {
-    std::cout << "Batch-size (b) : " << batch_size << std::endl;
-    int factor = batch_size >= num_bins ? 1'000 : 50;
-    int num_rounds = factor * num_bins / batch_size;
-    double one_choice_sum = 0.0, two_choice_sum = 0.0;
-    std::map<int, int> one_choice_max_load_counts, two_choice_max_load_counts;
-    for (int run = 0; run < runs; ++run) {
-      BatchedTwoChoiceSetting batched_two_choice(num_bins, batch_size);
-      for (int round = 0; round < num_rounds; ++round) {
-        batched_two_choice.nextRound(generator);
-        if (round == 0) {
-          int current_gap = std::ceil(batched_two_choice.getGap());
-          one_choice_max_load_counts[current_gap]++;
-          one_choice_sum += current_gap;
-        }
-      }
-      int current_gap = std::ceil(batched_two_choice.getGap());
-      two_choice_sum += current_gap;
-      two_choice_max_load_counts[current_gap]++;
-    }
-    one_choice_plot.push_back({ batch_size, one_choice_sum / runs });
-    two_choice_plot.push_back({ batch_size, two_choice_sum / runs });
-    std::cout << "Two-Choice:" << std::endl;
-    for (const auto [load, load_count] : two_choice_max_load_counts) {
-      std::cout << "\\textbf{" << load << "} : " << (load_count * 100 / runs) << "\\%" << std::endl;
-    }
-    std::cout << "One-Choice:" << std::endl;
-    for (const auto [load, load_count] : one_choice_max_load_counts) {
-      std::cout << "\\textbf{" << load << "} : " << (load_count * 100 / runs) << "\\%" << std::endl;
-    }
-    std::cout << std::endl;
+  if (flags.has("write-trace")) {
+    generate_trace<std::mt19937_64>(flags.getString("write-trace", ""), flags.getInt("trace-bins", 10'000),
+                                    flags.getInt("trace-balls", 10'000'000), options.seed);
+    return 0;
   }
-  std::cout << "=== Figure 12.2 ===" << std::endl;
-  std::cout << "One-Choice:" << std::endl;
-  for (const auto [x, y] : one_choice_plot) {
-    std::cout << "(" << x << ", " << y << ")" << std::endl;
+  if (flags.has("replay")) {
+    batched_replay(TraceReader(flags.getString("replay", "")), options);
+    return 0;
   }
-  std::cout << "Two-Choice:" << std::endl;
-  for (const auto [x, y] : two_choice_plot) {
-    std::cout << "(" << x << ", " << y << ")" << std::endl;
+
+  if (flags.has("tail-gap")) {
+    for (auto num_bins : bins) {
+      batched_tail_probabilities(num_bins, flags.getInt("tail-gap", 0), options, flags.getInt("trajectories", 1'000),
+                                 flags.getInt("starts", 1), flags.getInt("naive-runs", 0));
+    }
+    return 0;
   }
-}
 
-int main() {
   /* Runs experiments for Figure 12.2 and Table 12.4. */
-  batched_experiments(10'000);
+  uint64_t memory_budget = uint64_t(flags.getDouble("memory-budget", 4.0) * (uint64_t(1) << 30));
+  run_batched_experiments(bins, options, flags.getInt("threads", 1), memory_budget);
+  if (interrupted()) {
+    std::cerr << "Interrupted with " << journal->size() << " runs in the journal." << std::endl;
+    return 1;
+  }
   
   return 0;
 }
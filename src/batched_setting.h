@@ -0,0 +1,322 @@
+/* The Two-Choice process in the b-Batched setting. */
+#ifndef NOISE22_BATCHED_SETTING_H_
+#define NOISE22_BATCHED_SETTING_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.h"
+#include "load_store.h"
+#include "load_view.h"
+#include "snapshot.h"
+#include "trace.h"
+
+/* Runs the Two-Choice process in the b-Batched setting. This process was
+   introduced in
+     "Multiple-choice balanced allocation in (almost) parallel", 
+         by Berenbrink, Czumaj, Englert, Friedetzky, and Nagel (2012)
+         [https://arxiv.org/abs/1501.04822].
+   
+   It starts from an empty load vector and in each round:
+     - Allocates b (potentially weighted) balls using the process provided,
+       with the load information at the beginning of the batch.
+   
+   This class keeps track of the load-vector, the maximum load and gap.
+   The observer is notified of the allocations when a batch is merged.
+
+   If the load vector is in a file (`PageMode::kFile`), each batch looks up
+   and updates the loads of the sampled bins in increasing order of the
+   bins (sorting the O(b) samples and allocations), so the file is accessed
+   one block after the other and the buffer vector is not needed. The
+   allocations are the same as when merging a buffer vector.
+   */
+template<typename Observer>
+class BasicBatchedTwoChoiceSetting {
+public:
+
+  /* Initializes b-Batched setting for the given number of bins 
+     and batch size. */
+  BasicBatchedTwoChoiceSetting(size_t num_bins, size_t batch_size, const Observer& observer = Observer())    
+    : load_vector_(num_bins), buffer_vector_(0), uar_(0, num_bins - 1), batch_size_(batch_size), max_load_(0), total_balls_(0),
+      observer_(observer) {
+    if (!isPartitioned()) buffer_vector_ = LoadStore<size_t>(num_bins);
+  }
+  
+  /* Performs an allocation of a batch. */
+  template<typename Generator>
+  void nextRound(Generator& generator) {
+    if (isPartitioned()) {
+      samples_.clear();
+      for (size_t i = 0; i < batch_size_; ++i) {
+        size_t i1 = uar_(generator), i2 = uar_(generator);
+        samples_.push_back({ i1, i2 });
+      }
+      allocatePartitioned();
+      return;
+    }
+    allocateBuffer();
+    // Phase 1: Perform b allocations.
+    for (size_t i = 0; i < batch_size_; ++i) {
+      size_t i1 = uar_(generator), i2 = uar_(generator);
+      // Break ties randomly. 
+      size_t idx = load_vector_[i1] <= load_vector_[i2] ? i1 : i2;
+      ++buffer_vector_[idx];
+    }
+    total_balls_ += batch_size_;
+
+    // Phase 2: Update and sort the load vector.
+    updateLoads();
+  }
+
+  /* Performs an allocation of a batch with the samples of a trace (instead
+     of drawing them). Returns the number of samples used. */
+  template<typename Generator>
+  size_t replayRound(const TraceSample* samples, Generator&) {
+    if (isPartitioned()) {
+      samples_.assign(samples, samples + batch_size_);
+      allocatePartitioned();
+      return batch_size_;
+    }
+    allocateBuffer();
+    for (size_t i = 0; i < batch_size_; ++i) {
+      size_t i1 = samples[i].i1, i2 = samples[i].i2;
+      size_t idx = load_vector_[i1] <= load_vector_[i2] ? i1 : i2;
+      ++buffer_vector_[idx];
+    }
+    total_balls_ += batch_size_;
+    updateLoads();
+    return batch_size_;
+  }
+
+  /* Returns the number of trace samples used by a round. */
+  size_t getSamplesPerRound() const {
+    return batch_size_;
+  }
+
+  /* Returns the number of bins. */
+  size_t getNumBins() const {
+    return load_vector_.size();
+  }
+
+  /* Returns the current maximum load. */
+  double getMaxLoad() const {
+    return max_load_;
+  }
+
+  /* Returns the current gap. The integer part of the average load is
+     subtracted exactly, so the gap stays precise for any number of balls. */
+  double getGap() const {
+    size_t n = load_vector_.size();
+    return double(max_load_ - total_balls_ / n) - double(total_balls_ % n) / n;
+  }
+
+  /* Returns the gap rounded up, max load - floor(t/n), computed exactly. */
+  int64_t getGapCeiling() const {
+    return int64_t(max_load_ - total_balls_ / load_vector_.size());
+  }
+
+  /* Returns the gap rounded down, max load - ceil(t/n), computed exactly. */
+  int64_t getGapFloor() const {
+    size_t n = load_vector_.size();
+    return int64_t(max_load_ - (total_balls_ + n - 1) / n);
+  }
+
+  /* Returns the current load vector. */
+  std::vector<size_t> getLoadVector() const {
+    return std::vector<size_t>(load_vector_.begin(), load_vector_.end());
+  }
+
+  /* Returns a view of the current load vector (without copying it). */
+  LoadView getLoadView() const {
+    return LoadView(load_vector_);
+  }
+
+  /* Returns the observer of the setting. */
+  const Observer& getObserver() const {
+    return observer_;
+  }
+
+  /* Empties the load vector, reusing its memory, so that the setting can
+     be run again from the start. */
+  void reset() {
+    load_vector_.clear();
+    max_load_ = 0;
+    total_balls_ = 0;
+    observer_.onRestore(LoadView(load_vector_));
+  }
+
+  /* Returns an independent copy of the setting in its current state,
+     whose load vector is shared copy-on-write if it is large (see
+     `LoadStore::clone`). The generator is not part of the state, see
+     `branch_generator` for continuing the copy with an independent random
+     stream. */
+  BasicBatchedTwoChoiceSetting clone() const {
+    return BasicBatchedTwoChoiceSetting(*this, batch_size_);
+  }
+
+  /* Returns a copy of the setting in its current state, which continues
+     with a different batch size. */
+  BasicBatchedTwoChoiceSetting clone(size_t batch_size) const {
+    return BasicBatchedTwoChoiceSetting(*this, batch_size);
+  }
+
+  /* Saves the state of the setting and of the generator to a checkpoint,
+     with the result of the burn-in detection that led to it (if any). */
+  template<typename Generator>
+  void saveCheckpoint(const std::string& path, const Generator& generator, const BurnInResult& burn_in = { 0, 0, false }) const {
+    write_checkpoint(path, ProcessKind::kBatched, max_load_, total_balls_, batch_size_, generator, load_vector_.data(), load_vector_.size(), burn_in);
+  }
+
+  /* Restores the state of the setting and of the generator from a
+     checkpoint, so that the run resumes exactly. */
+  template<typename Generator>
+  void restoreCheckpoint(const CheckpointReader& checkpoint, Generator& generator) {
+    checkpoint.checkKind(ProcessKind::kBatched, load_vector_.size(), batch_size_);
+    const uint64_t* loads = checkpoint.getLoads();
+    std::copy(loads, loads + load_vector_.size(), load_vector_.begin());
+    max_load_ = checkpoint.getHeader().max_load;
+    total_balls_ = checkpoint.getHeader().total_balls;
+    checkpoint.restoreGenerator(generator);
+    observer_.onRestore(LoadView(load_vector_));
+  }
+
+  /* Saves a compressed snapshot of the load vector (without copying it). */
+  void saveSnapshot(const std::string& path) const {
+    write_snapshot(path, load_vector_.data(), load_vector_.size(), total_balls_, max_load_);
+  }
+
+  /* Returns the total number of balls allocated. */
+  size_t getTotalBalls() const {
+    return total_balls_;
+  }
+
+  /* Returns the quadratic potential sum_i (y_i - t/n)^2 in O(n) time. */
+  double getQuadraticPotential() const {
+    double average = total_balls_ / double(load_vector_.size());
+    double potential = 0.0;
+    for (auto load : load_vector_) {
+      potential += (load - average) * (load - average);
+    }
+    return potential;
+  }
+
+private:
+
+  /* The two bins sampled for a ball. */
+  struct Sample {
+    size_t i1;
+    size_t i2;
+
+    Sample(size_t i1, size_t i2) : i1(i1), i2(i2) {
+
+    }
+
+    Sample(const TraceSample& sample) : i1(sample.i1), i2(sample.i2) {
+
+    }
+  };
+
+  /* Whether the batches are allocated in increasing order of the bins. */
+  bool isPartitioned() const {
+    return load_vector_.getPageMode() == PageMode::kFile;
+  }
+
+  /* Allocates the balls of the batch in `samples_`, reading and then
+     updating the loads in increasing order of the bins. */
+  void allocatePartitioned() {
+    lookups_.clear();
+    for (size_t i = 0; i < samples_.size(); ++i) {
+      lookups_.push_back({ samples_[i].i1, 2 * i });
+      lookups_.push_back({ samples_[i].i2, 2 * i + 1 });
+    }
+    std::sort(lookups_.begin(), lookups_.end());
+    sampled_loads_.resize(lookups_.size());
+    for (const auto& [bin, slot] : lookups_) {
+      sampled_loads_[slot] = load_vector_[bin];
+    }
+    chosen_.clear();
+    for (size_t i = 0; i < samples_.size(); ++i) {
+      chosen_.push_back(sampled_loads_[2 * i] <= sampled_loads_[2 * i + 1] ? samples_[i].i1 : samples_[i].i2);
+    }
+    std::sort(chosen_.begin(), chosen_.end());
+    for (size_t begin = 0, end; begin < chosen_.size(); begin = end) {
+      for (end = begin + 1; end < chosen_.size() && chosen_[end] == chosen_[begin]; ++end);
+      size_t bin = chosen_[begin];
+      load_vector_[bin] += end - begin;
+      observer_.onAllocation(bin, load_vector_[bin] - (end - begin), load_vector_[bin]);
+      max_load_ = std::max(max_load_, load_vector_[bin]);
+    }
+    total_balls_ += samples_.size();
+    observer_.onBatchMerge(LoadView(load_vector_));
+  }
+
+  /* Allocates the (empty) buffer vector if the setting is a copy that has
+     not run a round yet. */
+  void allocateBuffer() {
+    if (buffer_vector_.size() != load_vector_.size()) {
+      buffer_vector_ = LoadStore<size_t>(load_vector_.size(), load_vector_.getPageMode());
+    }
+  }
+
+  /* Adds the allocations of the batch to the load vector. */
+  void updateLoads() {
+    size_t n = load_vector_.size();
+    for (size_t i = 0; i < n; ++i) {
+      load_vector_[i] += buffer_vector_[i];
+      if (buffer_vector_[i] != 0) observer_.onAllocation(i, load_vector_[i] - buffer_vector_[i], load_vector_[i]);
+      buffer_vector_[i] = 0;
+      max_load_ = std::max(max_load_, load_vector_[i]);
+    }
+    // std::sort(load_vector_.begin(), load_vector_.end(), std::greater<size_t>());
+    observer_.onBatchMerge(LoadView(load_vector_));
+  }
+
+  /* Copies the state of `other` and replaces its batch size. The buffer is
+     empty between rounds, so it is only allocated by the first round of the
+     copy (and never for copies that are only kept or scored). */
+  BasicBatchedTwoChoiceSetting(const BasicBatchedTwoChoiceSetting& other, size_t batch_size)
+    : load_vector_(other.load_vector_.clone()), buffer_vector_(0), uar_(other.uar_), batch_size_(batch_size), max_load_(other.max_load_), total_balls_(other.total_balls_),
+      observer_(other.observer_) {
+
+  }
+
+  /* Current load vector of the process. */
+  LoadStore<size_t> load_vector_;
+
+  /* Buffer vector for the balls allocated in the current batch (empty if
+     the batches are partitioned). */
+  LoadStore<size_t> buffer_vector_;
+
+  /* Scratch space of the partitioned batches: the samples, the (bin,
+     sample slot) pairs to look up, the loads found and the chosen bins. */
+  std::vector<Sample> samples_;
+  std::vector<std::pair<size_t, size_t>> lookups_;
+  std::vector<size_t> sampled_loads_;
+  std::vector<size_t> chosen_;
+
+  /* Sample a bin uniformly at random. */
+  std::uniform_int_distribution<size_t> uar_;
+
+  /* Batch size used in the setting. */
+  const size_t batch_size_;
+
+  /* Current maximum load in the load vector. */
+  size_t max_load_;
+
+  /* Total number of balls in the load vector. */
+  size_t total_balls_;
+
+  /* Observer of the allocations. */
+  Observer observer_;
+};
+
+/* The b-Batched setting without an observer. */
+using BatchedTwoChoiceSetting = BasicBatchedTwoChoiceSetting<NoObserver>;
+
+#endif  // NOISE22_BATCHED_SETTING_H_
@@ -0,0 +1,21 @@
+/* Helpers for running many continuations from the same process state.
+
+   A state is branched with the `clone()` of the processes. Load vectors of
+   at least `copy_on_write_threshold()` bytes are shared copy-on-write (see
+   load_store.h), so a branch costs O(1) time and memory until it modifies
+   pages, and a branch kept as a starting state (e.g., an entrance of the
+   splitting estimator) only holds the pages it modified; smaller load
+   vectors are copied. Branches are continued in the same process rather
+   than in fork()ed children, which could not hand a branch back to the
+   parent without copying it. */
+#ifndef NOISE22_BRANCHING_H_
+#define NOISE22_BRANCHING_H_
+
+/* Returns a generator for an independent random stream, seeded from the
+   parent stream. Copying the generator instead duplicates its stream. */
+template<typename Generator>
+Generator branch_generator(Generator& parent) {
+  return Generator(parent());
+}
+
+#endif  // NOISE22_BRANCHING_H_
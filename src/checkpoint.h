@@ -0,0 +1,240 @@
+/* Binary checkpoints of the state of a process, for resuming long runs and
+   warm-starting experiments from a stored (stationary) state.
+
+   The header only identifies the process (its kind, n and b), so the
+   drivers name the checkpoint files after everything else that determines
+   the state (see `checkpoint_file_name`).
+
+   A checkpoint file consists of:
+     - a `CheckpointHeader`,
+     - the textual state of the generator (as written by operator<<),
+     - padding up to a multiple of `kCheckpointAlignment` bytes, and
+     - the load vector as `num_bins` little-endian 64-bit integers.
+   Since the loads start at a page boundary, they can be used directly from
+   a read-only memory mapping of the file. */
+#ifndef NOISE22_CHECKPOINT_H_
+#define NOISE22_CHECKPOINT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "stationary.h"
+
+/* Alignment of the load vector within the checkpoint file. */
+constexpr uint64_t kCheckpointAlignment = 4096;
+
+/* Kind of process stored in a checkpoint. */
+enum class ProcessKind : uint32_t {
+  kTwoSample = 0,
+  kBatched = 1
+};
+
+/* Fixed-size header of a checkpoint file. */
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  ProcessKind kind;
+  uint64_t num_bins;
+  uint64_t max_load;
+  uint64_t total_balls;
+  /* Batch size for the b-Batched setting and 1 otherwise. */
+  uint64_t batch_size;
+  uint64_t generator_state_size;
+  /* Offset of the load vector from the beginning of the file. */
+  uint64_t loads_offset;
+  /* Result of the burn-in detection before the checkpoint (all 0 if the
+     warm-up ran for a fixed number of balls). */
+  uint64_t burn_in_rounds;
+  uint64_t mixing_rounds;
+  uint64_t mixed;
+};
+
+constexpr char kCheckpointMagic[8] = { 'N', 'O', 'I', 'S', 'E', '2', '2', 'C' };
+constexpr uint32_t kCheckpointVersion = 2;
+
+/* Returns the name of the checkpoint file of a trajectory of the given
+   configuration, which is warmed up for `warmup_balls` balls (or until it
+   mixes, with burn-in detection) by a generator of the given type and seed. */
+inline std::string checkpoint_file_name(
+  const std::string& configuration,
+  uint64_t warmup_balls,
+  const std::string& generator,
+  uint64_t seed,
+  bool detect_burn_in) {
+  return configuration + "_m" + std::to_string(warmup_balls) + "_" + generator + "_s" + std::to_string(seed)
+    + (detect_burn_in ? "_burn-in" : "") + ".ckpt";
+}
+
+namespace internal {
+
+/* Flushes the file (or directory) at `path` to stable storage. */
+inline void sync_path(const std::string& path) {
+#ifdef NOISE22_HAS_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Failed to open " + path);
+  int result = fsync(fd);
+  close(fd);
+  if (result != 0) throw std::runtime_error("Failed to sync " + path);
+#endif
+}
+
+/* Returns the directory containing `path`. */
+inline std::string parent_directory(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  if (slash == std::string::npos) return ".";
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+}  // namespace internal
+
+/* Returns true if a checkpoint file exists at the given path. */
+inline bool checkpoint_exists(const std::string& path) {
+  return std::ifstream(path).good();
+}
+
+/* Writes a checkpoint with the given header fields, generator, loads and
+   burn-in result.
+   The file is first written to "<path>.tmp", flushed to stable storage and
+   then renamed (and the rename is flushed too), so even after a power loss
+   the checkpoint at `path` is either the previous or the new one. */
+template<typename Generator>
+void write_checkpoint(
+  const std::string& path,
+  ProcessKind kind,
+  uint64_t max_load,
+  uint64_t total_balls,
+  uint64_t batch_size,
+  const Generator& generator,
+  const size_t* loads,
+  uint64_t num_bins,
+  const BurnInResult& burn_in) {
+  std::ostringstream generator_stream;
+  generator_stream << generator;
+  std::string generator_state = generator_stream.str();
+
+  CheckpointHeader header;
+  std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+  header.version = kCheckpointVersion;
+  header.kind = kind;
+  header.num_bins = num_bins;
+  header.max_load = max_load;
+  header.total_balls = total_balls;
+  header.batch_size = batch_size;
+  header.generator_state_size = generator_state.size();
+  uint64_t unaligned = sizeof(header) + generator_state.size();
+  header.loads_offset = (unaligned + kCheckpointAlignment - 1) / kCheckpointAlignment * kCheckpointAlignment;
+  header.burn_in_rounds = burn_in.rounds;
+  header.mixing_rounds = burn_in.mixing_rounds;
+  header.mixed = burn_in.mixed ? 1 : 0;
+
+  std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(generator_state.data(), generator_state.size());
+    std::vector<char> padding(header.loads_offset - unaligned, 0);
+    out.write(padding.data(), padding.size());
+    static_assert(sizeof(size_t) == sizeof(uint64_t), "Loads are stored as 64-bit integers.");
+    out.write(reinterpret_cast<const char*>(loads), num_bins * sizeof(uint64_t));
+    out.close();
+    if (!out) throw std::runtime_error("Failed to write checkpoint " + temporary_path);
+  }
+  internal::sync_path(temporary_path);
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Failed to rename checkpoint to " + path);
+  }
+  internal::sync_path(internal::parent_directory(path));
+}
+
+/* Read-only view of a checkpoint file, which is memory mapped where
+   supported (and read into memory otherwise). */
+class CheckpointReader {
+public:
+
+  explicit CheckpointReader(const std::string& path) : file_(path), data_(file_.data()), size_(file_.size()) {
+    if (size_ < sizeof(header_)) throw std::runtime_error("Truncated checkpoint " + path);
+    std::memcpy(&header_, data_, sizeof(header_));
+    if (std::memcmp(header_.magic, kCheckpointMagic, sizeof(header_.magic)) != 0 || header_.version != kCheckpointVersion) {
+      throw std::runtime_error("Not a checkpoint file " + path);
+    }
+    if (header_.loads_offset < sizeof(header_) + header_.generator_state_size
+        || header_.loads_offset + header_.num_bins * sizeof(uint64_t) != size_) {
+      throw std::runtime_error("Truncated or corrupt checkpoint " + path);
+    }
+  }
+
+  /* Returns the header of the checkpoint. */
+  const CheckpointHeader& getHeader() const {
+    return header_;
+  }
+
+  /* Returns the result of the burn-in detection before the checkpoint. */
+  BurnInResult getBurnIn() const {
+    return { header_.burn_in_rounds, header_.mixing_rounds, header_.mixed != 0 };
+  }
+
+  /* Returns the loads stored in the checkpoint (without copying them). */
+  const uint64_t* getLoads() const {
+    return reinterpret_cast<const uint64_t*>(data_ + header_.loads_offset);
+  }
+
+  /* Restores the state of the generator. */
+  template<typename Generator>
+  void restoreGenerator(Generator& generator) const {
+    std::istringstream in(std::string(data_ + sizeof(header_), header_.generator_state_size));
+    in >> generator;
+    if (!in) throw std::runtime_error("Checkpoint has a different generator type.");
+  }
+
+  /* Checks that the checkpoint stores a process of the given kind. */
+  void checkKind(ProcessKind kind, uint64_t num_bins, uint64_t batch_size) const {
+    if (header_.kind != kind || header_.num_bins != num_bins || header_.batch_size != batch_size) {
+      throw std::runtime_error("Checkpoint is for a different process.");
+    }
+  }
+
+private:
+
+  /* Contents of the file. */
+  const MappedFile file_;
+  const char* data_;
+  const size_t size_;
+
+  /* Copy of the header of the checkpoint. */
+  CheckpointHeader header_;
+};
+
+/* Brings the process to (at least) `warmup_balls` balls, starting from the
+   checkpoint at `path` if one exists and saving a checkpoint there every
+   `interval` rounds (if non-zero) and at the end. Returns the number of
+   rounds that were run. */
+template<typename Process, typename Generator>
+uint64_t checkpointed_warm_up(
+  Process& process,
+  Generator& generator,
+  const std::string& path,
+  uint64_t warmup_balls,
+  uint64_t interval) {
+  if (checkpoint_exists(path)) {
+    process.restoreCheckpoint(CheckpointReader(path), generator);
+  }
+  uint64_t rounds = 0;
+  while (process.getTotalBalls() < warmup_balls) {
+    process.nextRound(generator);
+    ++rounds;
+    if (interval != 0 && rounds % interval == 0) {
+      process.saveCheckpoint(path, generator);
+    }
+  }
+  process.saveCheckpoint(path, generator);
+  return rounds;
+}
+
+#endif  // NOISE22_CHECKPOINT_H_
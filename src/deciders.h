@@ -0,0 +1,72 @@
+/* Decision functions of the noisy settings in
+      "Balanced Allocations with the Choice of Noise"
+      by Dimitrios Los and Thomas Sauerwald (PODC'22). */
+#ifndef NOISE22_DECIDERS_H_
+#define NOISE22_DECIDERS_H_
+
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "load_view.h"
+#include "two_sample_process.h"
+
+template<typename Generator>
+size_t two_choice(LoadView load_vector, size_t i1, size_t i2, Generator&) {
+  if (load_vector[i1] <= load_vector[i2]) return i1;
+  return i2;
+}
+
+template<typename Generator>
+DeciderFn<Generator> g_bounded(int g) {
+  return [g](LoadView load_vector, size_t i1, size_t i2, Generator&) {
+    // Do normal Two-Choice.
+    if (std::llabs(static_cast<long long>(load_vector[i1]) - static_cast<long long>(load_vector[i2])) > g) {
+      if (load_vector[i1] <= load_vector[i2]) return i1;
+      return i2;
+    }
+    // Reverse the allocation.
+    if (load_vector[i1] <= load_vector[i2]) return i2;
+    return i1;
+  };
+}
+
+template<typename Generator>
+DeciderFn<Generator> g_myopic(int g) {
+  return [g](LoadView load_vector, size_t i1, size_t i2, Generator& generator) {
+    // If the difference is small, then randomise the allocation.
+    if (std::llabs(static_cast<long long>(load_vector[i1]) - static_cast<long long>(load_vector[i2])) <= g) {
+      std::bernoulli_distribution randomiser(0.5);
+      return randomiser(generator) ? i1 : i2;
+    }
+    // Do normal Two-Choice.
+    if (load_vector[i1] <= load_vector[i2]) return i1;
+    return i2;
+  };
+}
+
+template<typename Generator>
+DeciderFn<Generator> sigma_noisy(int sigma) {
+  return [sigma](LoadView load_vector, size_t i1, size_t i2, Generator& generator) {
+    std::normal_distribution<double> noise_distribution(0.0, sigma);
+    long long load_estimate_1 = load_vector[i1] + noise_distribution(generator);
+    long long load_estimate_2 = load_vector[i2] + noise_distribution(generator);
+    if (load_estimate_1 <= load_estimate_2) return i1;
+    return i2;
+  };
+}
+
+/* Returns the decider with the given name ("two-choice", "g-bounded",
+   "g-myopic" or "sigma-noisy") as a function of its parameter. */
+template<typename Generator>
+std::function<DeciderFn<Generator>(int)> decider_producer(const std::string& name) {
+  if (name == "two-choice") return [](int) { return DeciderFn<Generator>(two_choice<Generator>); };
+  if (name == "g-bounded") return g_bounded<Generator>;
+  if (name == "g-myopic") return g_myopic<Generator>;
+  if (name == "sigma-noisy") return sigma_noisy<Generator>;
+  throw std::runtime_error("Unknown decider " + name);
+}
+
+#endif  // NOISE22_DECIDERS_H_
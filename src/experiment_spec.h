@@ -0,0 +1,157 @@
+/* Declarative specs of the experiments run by the `Experiments` driver.
+
+   A spec file lists experiments in a TOML-like format:
+
+     # Settings before the first section apply to every experiment.
+     seed = 1
+     engine = "mt19937_64"
+
+     [noisy-small]
+     process = "noisy"
+     decider = ["sigma-noisy", "g-bounded"]
+     params = 1..20
+     bins = [10000, 50000]
+     mode = "independent"
+     runs = 100
+
+     [batched]
+     process = "batched"
+     batch-sizes = [5, 50, 500]
+     bins = 10000
+
+   Values are numbers, strings (quoted or not), lists in brackets and
+   ranges "a..b", and `true`/`false` set or clear an option. The keys are
+   the flags of the driver (with '_' accepted for '-'). The flags given on
+   the command line override the spec in every experiment. Settings that
+   apply to the whole driver (its global keys) can only be given before the
+   first section. */
+#ifndef NOISE22_EXPERIMENT_SPEC_H_
+#define NOISE22_EXPERIMENT_SPEC_H_
+
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "flags.h"
+
+/* A named experiment and its settings. */
+struct ExperimentSpec {
+  std::string name;
+  Flags settings;
+};
+
+namespace internal {
+
+inline std::string trim(const std::string& text) {
+  size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) return "";
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+/* Returns the value in the representation of the flags: strings without
+   quotes and lists as comma-separated entries. */
+inline std::string spec_value(std::string value) {
+  bool list = value.size() >= 2 && value.front() == '[' && value.back() == ']';
+  if (list) value = value.substr(1, value.size() - 2);
+  std::string result;
+  std::istringstream entries(value);
+  std::string entry;
+  while (std::getline(entries, entry, list ? ',' : '\n')) {
+    entry = trim(entry);
+    if (entry.size() >= 2 && (entry.front() == '"' || entry.front() == '\'') && entry.back() == entry.front()) {
+      entry = entry.substr(1, entry.size() - 2);
+    }
+    if (entry.empty()) continue;
+    if (!result.empty()) result += ",";
+    result += entry;
+  }
+  return result;
+}
+
+/* Returns the flag of a key of the spec, i.e., with '-' for '_'. */
+inline std::string setting_key(std::string key) {
+  for (auto& c : key) {
+    if (c == '_') c = '-';
+  }
+  return key;
+}
+
+/* Applies `key = value` to the settings. */
+inline void apply_setting(Flags& settings, const std::string& key, const std::string& value) {
+  if (value == "false") {
+    settings.erase(key);
+  } else {
+    settings.set(key, value);
+  }
+}
+
+}  // namespace internal
+
+/* Parses the experiments of a spec, where the `overrides` (e.g., the
+   command line flags) take precedence over the spec. A spec without
+   sections is a single experiment named "experiment". Throws if one of the
+   `global_keys` is set inside a section. */
+inline std::vector<ExperimentSpec> parse_experiment_specs(
+  const std::string& contents,
+  const Flags& overrides,
+  const std::set<std::string>& global_keys = {}) {
+  Flags defaults;
+  std::vector<ExperimentSpec> specs;
+  std::istringstream lines(contents);
+  std::string line;
+  for (size_t number = 1; std::getline(lines, line); ++number) {
+    // Removes a comment outside of quotes.
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+      if (line[i] == '"') quoted = !quoted;
+      if (line[i] == '#' && !quoted) {
+        line.resize(i);
+        break;
+      }
+    }
+    line = internal::trim(line);
+    if (line.empty()) continue;
+    if (line.front() == '[' && line.back() == ']') {
+      specs.push_back({ internal::trim(line.substr(1, line.size() - 2)), defaults });
+      continue;
+    }
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      throw std::runtime_error("Malformed line " + std::to_string(number) + " of the spec: " + line);
+    }
+    Flags& settings = specs.empty() ? defaults : specs.back().settings;
+    std::string key = internal::setting_key(internal::trim(line.substr(0, eq)));
+    if (!specs.empty() && global_keys.count(key) > 0) {
+      throw std::runtime_error("Line " + std::to_string(number) + " of the spec sets " + key
+        + " inside [" + specs.back().name + "], but it applies to all experiments and must come before the first section");
+    }
+    internal::apply_setting(settings, key, internal::spec_value(internal::trim(line.substr(eq + 1))));
+  }
+  if (specs.empty()) {
+    specs.push_back({ "experiment", defaults });
+  }
+  for (auto& spec : specs) {
+    for (const auto& [key, value] : overrides.getValues()) {
+      spec.settings.set(key, value);
+    }
+  }
+  return specs;
+}
+
+/* Reads the experiments of the spec file at `path`. */
+inline std::vector<ExperimentSpec> read_experiment_specs(
+  const std::string& path,
+  const Flags& overrides,
+  const std::set<std::string>& global_keys = {}) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Failed to open spec " + path);
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  return parse_experiment_specs(contents, overrides, global_keys);
+}
+
+#endif  // NOISE22_EXPERIMENT_SPEC_H_
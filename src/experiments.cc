@@ -0,0 +1,295 @@
+/* Runs the experiments of a declarative spec (see experiment_spec.h), e.g.,
+   a subset of the configurations of
+      "Balanced Allocations with the Choice of Noise"
+      by Dimitrios Los and Thomas Sauerwald (PODC'22)
+      [https://arxiv.org/abs/2302.04399],
+   without recompiling. It first prints the plan (the configurations of
+   every experiment and their estimated running time) and then runs only
+   the requested configurations.
+
+   Usage: Experiments [--spec=<file>] [--only=<e1>,<e2>,...] [--dry-run] [--<key>=<value>...]
+
+   The settings of an experiment (from the spec or the command line) are:
+       --process=noisy|batched  (default: noisy)
+       --decider=<d1>,<d2>,...  (noisy; sigma-noisy, g-bounded, g-myopic or
+                                 two-choice; default: the first three)
+       --params=<p1>,<p2>,... or <a>..<b>  (noisy; default: 1..20)
+       --bins=<n1>,<n2>,...  (default: 10000,50000,100000 for noisy and 10000 for batched)
+       --m=<balls as a multiple of n>  (default: 1000 for noisy; 1000 if b >= n and 50 otherwise for batched)
+       --batch-sizes=<b1>,<b2>,...  (batched; default: those of Table 12.4)
+       --mode=independent|stationary  (noisy; default: stationary)
+       --runs=<runs (or samples) per configuration>  (default: 100)
+       --interval=<balls between samples in stationary mode>  (default: m)
+       --ci=batch-means|autocorrelation  (stationary; prints the mean gap
+                                          and its interval, as does --interval)
+       --horizons=<h1>,<h2>,...  (measure after h1 n, h2 n, ... balls in each run)
+       --precision=<p>, --min-runs=<runs>, --max-runs=<runs>  (see statistics.h)
+       --detect-burn-in, --continuation  (as in the drivers)
+       --engine=mt19937_64|mt19937  (default: mt19937_64)
+       --seed=<base seed of the runs>  (default: 0)
+       --threads=<threads>, --memory-budget=<GB>  (see scheduler.h)
+       --results=<file>, --cache=<directory>, --journal=<file>, --shard=<k>/<K>
+     and for all experiments (on the command line or before the first
+     section of the spec, as a section cannot set them):
+       --pages=default|transparent|2m|1g, --store-dir=<directory>
+       --placement=none|compact|scatter|per-socket */
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "batched_experiments.h"
+#include "experiment_spec.h"
+#include "flags.h"
+#include "journal.h"
+#include "load_store.h"
+#include "noise_experiments.h"
+#include "numa.h"
+#include "result_cache.h"
+#include "result_sink.h"
+#include "scheduler.h"
+#include "sharding.h"
+
+/* Settings of the whole driver, which a spec can only give before its first
+   section. */
+const std::set<std::string> kGlobalKeys = { "pages", "store-dir", "placement" };
+
+/* Result files, caches and journals of the experiments, opened once per
+   path so that experiments can share them. */
+class SharedOutputs {
+public:
+
+  ResultSink* getResults(const Flags& settings) {
+    if (!settings.has("results")) return nullptr;
+    auto& sink = results_[settings.getString("results", "")];
+    if (sink == nullptr) sink = make_result_sink(settings.getString("results", ""));
+    return sink.get();
+  }
+
+  ResultCache* getCache(const Flags& settings) {
+    if (!settings.has("cache")) return nullptr;
+    auto& cache = caches_[settings.getString("cache", "")];
+    if (cache == nullptr) cache = std::make_unique<ResultCache>(settings.getString("cache", ""));
+    return cache.get();
+  }
+
+  Journal* getJournal(const Flags& settings) {
+    if (!settings.has("journal")) return nullptr;
+    auto& journal = journals_[settings.getString("journal", "")];
+    if (journal == nullptr) {
+      journal = std::make_unique<Journal>(settings.getString("journal", ""));
+      install_interrupt_handlers();
+    }
+    return journal.get();
+  }
+
+private:
+
+  std::map<std::string, std::unique_ptr<ResultSink>> results_;
+  std::map<std::string, std::unique_ptr<ResultCache>> caches_;
+  std::map<std::string, std::unique_ptr<Journal>> journals_;
+};
+
+/* Configurations of an experiment and their estimated cost. */
+struct ExperimentPlan {
+  size_t configurations = 0;
+  JobEstimate estimate;
+  /* Largest estimated memory of a single configuration. */
+  uint64_t peak_memory_bytes = 0;
+};
+
+std::vector<std::string> deciders_of(const Flags& settings) {
+  std::vector<std::string> deciders = settings.getList("decider");
+  if (deciders.empty()) {
+    for (const auto& [decider, heading] : kNoiseSweepHeadings) {
+      deciders.push_back(decider);
+    }
+  }
+  return deciders;
+}
+
+std::vector<int> params_of(const Flags& settings) {
+  std::vector<long long> values = settings.getIntList("params");
+  if (values.empty()) values = Flags(std::map<std::string, std::string>{ { "params", "1..20" } }).getIntList("params");
+  return std::vector<int>(values.begin(), values.end());
+}
+
+std::vector<long long> batched_bins_of(const Flags& settings) {
+  std::vector<long long> bins = settings.getIntList("bins");
+  if (bins.empty()) bins.push_back(10'000);
+  return bins;
+}
+
+SamplingOptions sampling_options(const Flags& settings, SharedOutputs& outputs) {
+  SamplingOptions options;
+  if (settings.getString("mode", "stationary") == "independent") {
+    options.mode = SamplingMode::kIndependentRuns;
+  }
+  options.samples = settings.getInt("runs", options.samples);
+  options.sample_interval = settings.getInt("interval", 0);
+  if (settings.getString("ci", "batch-means") == "autocorrelation") {
+    options.interval_method = IntervalMethod::kAutocorrelation;
+  }
+  options.print_interval = settings.has("interval") || settings.has("ci");
+  options.detect_burn_in = settings.has("detect-burn-in");
+  options.continuation = settings.has("continuation");
+  options.stopping.precision = settings.getDouble("precision", 0.0);
+  options.stopping.min_runs = settings.getInt("min-runs", options.samples);
+  options.stopping.max_runs = settings.getInt("max-runs", options.samples);
+  options.seed = settings.getInt("seed", 0);
+  options.horizons = settings.getIntList("horizons");
+  options.bins = settings.getIntList("bins");
+  options.results = outputs.getResults(settings);
+  options.cache = outputs.getCache(settings);
+  options.journal = outputs.getJournal(settings);
+  if (settings.has("shard")) {
+    options.shard = parse_shard(settings.getString("shard", "0/1"));
+    if (options.mode != SamplingMode::kIndependentRuns || options.stopping.precision > 0.0) {
+      throw std::runtime_error("--shard needs --mode=independent and no --precision");
+    }
+  }
+  return options;
+}
+
+BatchedOptions batched_options(const Flags& settings, SharedOutputs& outputs) {
+  BatchedOptions options;
+  std::vector<long long> batch_sizes = settings.getIntList("batch-sizes");
+  if (!batch_sizes.empty()) options.batch_sizes.assign(batch_sizes.begin(), batch_sizes.end());
+  options.balls_factor = settings.getInt("m", 0);
+  options.detect_burn_in = settings.has("detect-burn-in");
+  options.stopping.precision = settings.getDouble("precision", 0.0);
+  options.stopping.min_runs = settings.getInt("min-runs", settings.getInt("runs", 100));
+  options.stopping.max_runs = settings.getInt("max-runs", settings.getInt("runs", 100));
+  options.seed = settings.getInt("seed", 0);
+  options.horizons = settings.getIntList("horizons");
+  options.results = outputs.getResults(settings);
+  options.cache = outputs.getCache(settings);
+  options.journal = outputs.getJournal(settings);
+  if (settings.has("shard")) {
+    options.shard = parse_shard(settings.getString("shard", "0/1"));
+    if (options.stopping.precision > 0.0) throw std::runtime_error("--shard needs no --precision");
+  }
+  return options;
+}
+
+/* Returns the configurations of the experiment and their estimated cost,
+   throwing if its settings are invalid. */
+ExperimentPlan plan_experiment(const ExperimentSpec& spec) {
+  const Flags& settings = spec.settings;
+  std::string engine = settings.getString("engine", "mt19937_64");
+  if (engine != "mt19937_64" && engine != "mt19937") throw std::runtime_error("Unknown engine " + engine);
+  CostModel model;
+  ExperimentPlan plan;
+  SharedOutputs no_outputs;
+  Flags without_outputs = settings;
+  for (const char* key : { "results", "cache", "journal" }) {
+    without_outputs.erase(key);
+  }
+  auto add = [&plan](const JobEstimate& estimate, size_t configurations) {
+    plan.configurations += configurations;
+    plan.estimate.seconds += estimate.seconds;
+    plan.peak_memory_bytes = std::max(plan.peak_memory_bytes, estimate.memory_bytes);
+  };
+  std::string process = settings.getString("process", "noisy");
+  if (process == "noisy") {
+    SamplingOptions options = sampling_options(without_outputs, no_outputs);
+    std::vector<int> params = params_of(settings);
+    for (const auto& decider : deciders_of(settings)) {
+      decider_producer<std::mt19937_64>(decider);
+      for (auto n : bin_counts(options)) {
+        add(estimate_noise_sweep(model, n, settings.getInt("m", 1'000), params.size(), options), params.size());
+      }
+    }
+  } else if (process == "batched") {
+    BatchedOptions options = batched_options(without_outputs, no_outputs);
+    for (auto n : batched_bins_of(settings)) {
+      for (auto batch_size : options.batch_sizes) {
+        add(estimate_batched_configuration(model, n, batch_size, options), 1);
+      }
+    }
+  } else {
+    throw std::runtime_error("Unknown process " + process);
+  }
+  plan.estimate.memory_bytes = plan.peak_memory_bytes;
+  return plan;
+}
+
+template<typename Generator>
+void run_experiment(const ExperimentSpec& spec, SharedOutputs& outputs) {
+  const Flags& settings = spec.settings;
+  size_t threads = settings.getInt("threads", 1);
+  uint64_t memory_budget = uint64_t(settings.getDouble("memory-budget", 4.0) * (uint64_t(1) << 30));
+  if (settings.getString("process", "noisy") == "noisy") {
+    std::vector<NoiseSweep<Generator>> sweeps;
+    for (const auto& decider : deciders_of(settings)) {
+      sweeps.push_back(make_noise_sweep<Generator>(decider));
+    }
+    run_noise_sweeps<Generator>(sweeps, settings.getInt("m", 1'000), params_of(settings), sampling_options(settings, outputs),
+                                threads, memory_budget);
+  } else {
+    run_batched_experiments<Generator>(batched_bins_of(settings), batched_options(settings, outputs), threads, memory_budget);
+  }
+}
+
+int main(int argc, char** argv) {
+  Flags flags(argc, argv);
+  Flags overrides = flags;
+  for (const char* key : { "spec", "only", "dry-run" }) {
+    overrides.erase(key);
+  }
+  std::vector<ExperimentSpec> specs = flags.has("spec")
+    ? read_experiment_specs(flags.getString("spec", ""), overrides, kGlobalKeys)
+    : std::vector<ExperimentSpec>{ { flags.getString("process", "noisy"), overrides } };
+  std::vector<std::string> only = flags.getList("only");
+  if (!only.empty()) {
+    std::vector<ExperimentSpec> selected;
+    for (const auto& spec : specs) {
+      if (std::find(only.begin(), only.end(), spec.name) != only.end()) selected.push_back(spec);
+    }
+    specs = selected;
+  }
+  // The global settings are the same in every experiment.
+  if (!specs.empty()) {
+    const Flags& settings = specs.front().settings;
+    default_page_mode() = parse_page_mode(settings.getString("pages", "default"));
+    if (settings.has("store-dir")) {
+      store_directory() = settings.getString("store-dir", ".");
+      default_page_mode() = PageMode::kFile;
+    }
+    thread_placement() = parse_placement_policy(settings.getString("placement", "none"));
+  }
+
+  double total_seconds = 0.0;
+  size_t total_configurations = 0;
+  for (const auto& spec : specs) {
+    ExperimentPlan plan = plan_experiment(spec);
+    std::cerr << "Experiment " << spec.name << " : " << spec.settings.getString("process", "noisy") << ", "
+              << plan.configurations << " configurations, estimated " << plan.estimate.seconds << " s and "
+              << plan.peak_memory_bytes / double(uint64_t(1) << 20) << " MB per configuration" << std::endl;
+    total_seconds += plan.estimate.seconds;
+    total_configurations += plan.configurations;
+  }
+  std::cerr << "Total : " << total_configurations << " configurations, estimated " << total_seconds << " s of work" << std::endl;
+  if (flags.has("dry-run")) return 0;
+
+  SharedOutputs outputs;
+  for (const auto& spec : specs) {
+    if (interrupted()) break;
+    std::cout << "Experiment : " << spec.name << "\n\n";
+    if (spec.settings.getString("engine", "mt19937_64") == "mt19937") {
+      run_experiment<std::mt19937>(spec, outputs);
+    } else {
+      run_experiment<std::mt19937_64>(spec, outputs);
+    }
+  }
+  if (interrupted()) {
+    std::cerr << "Interrupted; the completed runs are in the journal." << std::endl;
+    return 1;
+  }
+  return 0;
+}
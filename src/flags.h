@@ -0,0 +1,109 @@
+/* Minimal command line parsing for the experiment drivers. */
+#ifndef NOISE22_FLAGS_H_
+#define NOISE22_FLAGS_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Parses flags of the form "--key=value" and "--key" (which is treated as
+   "--key=true"). Arguments that do not start with "--" are ignored. The
+   settings of an experiment spec (see experiment_spec.h) use the same
+   representation. */
+class Flags {
+public:
+
+  Flags(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg(argv[i]);
+      if (arg.rfind("--", 0) != 0) continue;
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos) {
+        values_[arg.substr(2)] = "true";
+      } else {
+        values_[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      }
+    }
+  }
+
+  explicit Flags(std::map<std::string, std::string> values = {}) : values_(std::move(values)) {
+
+  }
+
+  /* Sets (or replaces) the value of a flag. */
+  void set(const std::string& key, const std::string& value) {
+    values_[key] = value;
+  }
+
+  /* Removes the flag, if given. */
+  void erase(const std::string& key) {
+    values_.erase(key);
+  }
+
+  /* Returns the values of all flags given, keyed by their name. */
+  const std::map<std::string, std::string>& getValues() const {
+    return values_;
+  }
+
+  /* Returns true if the flag was given. */
+  bool has(const std::string& key) const {
+    return values_.count(key) > 0;
+  }
+
+  /* Returns the value of the flag or the default if it was not given. */
+  std::string getString(const std::string& key, const std::string& default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : it->second;
+  }
+
+  long long getInt(const std::string& key, long long default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : std::stoll(it->second);
+  }
+
+  double getDouble(const std::string& key, double default_value) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? default_value : std::stod(it->second);
+  }
+
+  /* Returns the comma-separated integers of the flag (empty if not given),
+     where an entry "a..b" stands for a, a + 1, ..., b. */
+  std::vector<long long> getIntList(const std::string& key) const {
+    std::vector<long long> values;
+    for (const auto& entry : getList(key)) {
+      size_t range = entry.find("..");
+      if (range == std::string::npos) {
+        values.push_back(std::stoll(entry));
+        continue;
+      }
+      long long last = std::stoll(entry.substr(range + 2));
+      for (long long value = std::stoll(entry.substr(0, range)); value <= last; ++value) {
+        values.push_back(value);
+      }
+    }
+    return values;
+  }
+
+  /* Returns the comma-separated entries of the flag (empty if not given). */
+  std::vector<std::string> getList(const std::string& key) const {
+    std::vector<std::string> values;
+    auto it = values_.find(key);
+    if (it == values_.end()) return values;
+    size_t begin = 0;
+    while (begin <= it->second.size()) {
+      size_t end = it->second.find(',', begin);
+      if (end == std::string::npos) end = it->second.size();
+      if (end > begin) values.push_back(it->second.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    return values;
+  }
+
+private:
+
+  /* Values of the flags given, keyed by their name. */
+  std::map<std::string, std::string> values_;
+};
+
+#endif  // NOISE22_FLAGS_H_
@@ -0,0 +1,38 @@
+/* Merges result files written with --results (in any of the formats) and
+   prints their gap distributions as LaTeX table entries and their mean gaps
+   as pgfplots coordinate lists, or with --tables, as the tables printed by
+   the drivers (e.g., to combine the result files of the shards of a sweep).
+
+   Usage: FormatResults [--tables] <results file>... */
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "latex.h"
+#include "result_sink.h"
+
+int main(int argc, char** argv) {
+  bool tables = argc > 1 && std::string(argv[1]) == "--tables";
+  int first_file = tables ? 2 : 1;
+  if (argc <= first_file) {
+    std::cerr << "Usage: " << argv[0] << " [--tables] <results file>..." << std::endl;
+    return 1;
+  }
+  std::vector<ResultRow> rows;
+  try {
+    for (int i = first_file; i < argc; ++i) {
+      std::vector<ResultRow> file_rows = read_results(argv[i]);
+      rows.insert(rows.end(), file_rows.begin(), file_rows.end());
+    }
+  } catch (const std::runtime_error& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  if (tables) {
+    format_driver_tables(rows, std::cout);
+  } else {
+    format_results(rows, std::cout);
+  }
+  return 0;
+}
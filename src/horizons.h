@@ -0,0 +1,48 @@
+/* Measurement of a process at several horizons within a single run. */
+#ifndef NOISE22_HORIZONS_H_
+#define NOISE22_HORIZONS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "trajectory.h"
+
+/* Runs the process up to the last of the (increasing) `horizons`, given in
+   rounds, and calls `measure(index, process)` as it reaches each of them.
+   So, measuring a whole m-curve costs as much as its longest point. If
+   `recorder` is not null, the trajectory is also recorded, and if
+   `progress` is not null, the progress towards the last horizon is
+   reported. */
+template<typename Process, typename Generator, typename Measure>
+void run_to_horizons(
+  Process& process,
+  Generator& generator,
+  const std::vector<uint64_t>& horizons,
+  Measure measure,
+  TrajectoryRecorder* recorder = nullptr,
+  ProgressReporter* progress = nullptr) {
+  uint64_t round = 0;
+  for (size_t i = 0; i < horizons.size(); ++i) {
+    run_recorded(process, generator, horizons[i] - round, recorder, progress);
+    round = horizons[i];
+    measure(i, static_cast<const Process&>(process));
+  }
+}
+
+/* Returns the horizons (in balls) for the given multiples of n in
+   increasing order, or just `default_multiple` * n if none are given. */
+inline std::vector<uint64_t> horizons_in_balls(std::vector<long long> multiples, long long default_multiple, uint64_t n) {
+  if (multiples.empty()) {
+    multiples.push_back(default_multiple);
+  }
+  std::sort(multiples.begin(), multiples.end());
+  multiples.erase(std::unique(multiples.begin(), multiples.end()), multiples.end());
+  std::vector<uint64_t> horizons;
+  for (auto multiple : multiples) {
+    horizons.push_back(uint64_t(multiple) * n);
+  }
+  return horizons;
+}
+
+#endif  // NOISE22_HORIZONS_H_
@@ -0,0 +1,177 @@
+/* Crash-safe journal of the completed runs of an experiment sweep. */
+#ifndef NOISE22_JOURNAL_H_
+#define NOISE22_JOURNAL_H_
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+/* Result of a single run (or sample) of a configuration. */
+struct RunRecord {
+  /* Name of the process, e.g., "sigma-noisy" or "batched-two-choice". */
+  std::string process;
+  /* Parameter of the process (g, sigma or the batch size b). */
+  long long param;
+  /* Number of bins. */
+  uint64_t n;
+  /* Number of balls allocated when the gap was measured. */
+  uint64_t m;
+  /* Index of the run (or of the sample for a single trajectory). */
+  uint64_t run;
+  /* Seed of the run (or of the trajectory). */
+  uint64_t seed;
+  /* Measured gap, rounded as in the tables. */
+  int gap;
+  /* Generator type and any other option that affects the gap (e.g.,
+     burn-in detection), as in the `CacheKey` of the run. */
+  std::string variant;
+};
+
+/* Appends records to a journal file, one line per record:
+     process \t param \t n \t m \t run \t seed \t gap \t variant
+   A run is only found again with the same seed and variant, so a journal
+   never serves the runs of an experiment with another base seed, generator
+   or burn-in mode (and lines of older journals without a variant are
+   ignored by the current drivers).
+   Every record is flushed to stable storage before `append` returns, so
+   after a crash the journal holds all completed runs (and possibly a
+   partial last line, which is ignored when the journal is reopened). Runs
+   can be looked up and appended from several threads. */
+class Journal {
+public:
+
+  /* Opens the journal at the given path, loading its existing records. */
+  explicit Journal(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    // Only lines terminated by a newline were completely written.
+    size_t begin = 0, end;
+    while ((end = contents.find('\n', begin)) != std::string::npos) {
+      RunRecord record;
+      if (parse(contents.substr(begin, end - begin), record)) {
+        records_[key(record)] = record;
+      }
+      begin = end + 1;
+    }
+    file_ = std::fopen(path.c_str(), "a");
+    if (file_ == nullptr) throw std::runtime_error("Failed to open journal " + path);
+    if (begin < contents.size()) {
+      // Terminate the partial last line so that it stays malformed.
+      std::fputc('\n', file_);
+    }
+  }
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  ~Journal() {
+    std::fclose(file_);
+  }
+
+  /* Returns the record of the given run, or nullptr if it is not journaled. */
+  const RunRecord* find(
+    const std::string& process,
+    long long param,
+    uint64_t n,
+    uint64_t m,
+    uint64_t run,
+    uint64_t seed,
+    const std::string& variant) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(Key(process, param, n, m, run, seed, variant));
+    return it == records_.end() ? nullptr : &it->second;
+  }
+
+  /* Durably appends the record to the journal. */
+  void append(const RunRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fprintf(file_, "%s\t%lld\t%llu\t%llu\t%llu\t%llu\t%d\t%s\n",
+      record.process.c_str(), record.param,
+      (unsigned long long) record.n, (unsigned long long) record.m,
+      (unsigned long long) record.run, (unsigned long long) record.seed, record.gap,
+      record.variant.c_str());
+    std::fflush(file_);
+#if defined(__unix__) || defined(__APPLE__)
+    fsync(fileno(file_));
+#elif defined(_WIN32)
+    _commit(_fileno(file_));
+#endif
+    records_[key(record)] = record;
+  }
+
+  /* Returns the number of records in the journal. */
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_.size();
+  }
+
+  /* Parses a line of the journal, returning false if it is malformed. */
+  static bool parse(const std::string& line, RunRecord& record) {
+    std::istringstream in(line);
+    if (!(std::getline(in, record.process, '\t')
+      >> record.param >> record.n >> record.m >> record.run >> record.seed >> record.gap)) {
+      return false;
+    }
+    record.variant.clear();
+    if (in.get() == '\t') std::getline(in, record.variant);
+    return true;
+  }
+
+private:
+
+  using Key = std::tuple<std::string, long long, uint64_t, uint64_t, uint64_t, uint64_t, std::string>;
+
+  static Key key(const RunRecord& record) {
+    return Key(record.process, record.param, record.n, record.m, record.run, record.seed, record.variant);
+  }
+
+  /* Journal file opened for appending. */
+  FILE* file_;
+
+  /* Records in the journal, keyed by their configuration and run. */
+  std::map<Key, RunRecord> records_;
+
+  /* Guards the file and the records. */
+  mutable std::mutex mutex_;
+};
+
+namespace internal {
+
+inline volatile std::sig_atomic_t interrupted_flag = 0;
+
+inline void handle_interrupt(int) {
+  interrupted_flag = 1;
+}
+
+}  // namespace internal
+
+/* Installs handlers for SIGINT and SIGTERM, after which these signals only
+   set the flag returned by `interrupted()`, so that the drivers can stop
+   after the current run with all completed runs journaled. */
+inline void install_interrupt_handlers() {
+  std::signal(SIGINT, internal::handle_interrupt);
+  std::signal(SIGTERM, internal::handle_interrupt);
+}
+
+/* Returns true if SIGINT or SIGTERM was received. */
+inline bool interrupted() {
+  return internal::interrupted_flag != 0;
+}
+
+#endif  // NOISE22_JOURNAL_H_
@@ -0,0 +1,220 @@
+/* Formatting of the gap distributions as the LaTeX table entries and the
+   pgfplots coordinate lists used in the paper, and as the tables printed by
+   the drivers. */
+#ifndef NOISE22_LATEX_H_
+#define NOISE22_LATEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "result_sink.h"
+#include "statistics.h"
+
+/* Prints the empirical gap distribution as "\textbf{gap} : p\%" lines,
+   with the Wilson interval of each entry if `with_intervals` is set. */
+inline void print_gap_distribution(const GapStatistics& statistics, bool with_intervals, std::ostream& out) {
+  size_t runs = statistics.getCount();
+  for (int load = statistics.getMinGap(); load <= statistics.getMaxGap(); ++load) {
+    size_t load_count = statistics.getGapCount(load);
+    if (load_count == 0) continue;
+    out << "\\textbf{" << load << "} : " << (load_count * 100 / runs) << "\\%";
+    if (with_intervals) {
+      ConfidenceInterval interval = statistics.getGapInterval(load);
+      out << " [" << interval.lower * 100 << ", " << interval.upper * 100 << "]";
+    }
+    out << "\n";
+  }
+}
+
+/* Prints the mean mixing point of the runs simulated with burn-in
+   detection, given the sum of their mixing points. */
+inline void print_mixing_point(double mixing_sum, size_t simulated_runs, std::ostream& out) {
+  if (simulated_runs == 0) {
+    out << "Mixing point : - (no simulated runs)\n";
+  } else {
+    out << "Mixing point : " << mixing_sum / simulated_runs << " balls\n";
+  }
+}
+
+/* Prints the points as a pgfplots coordinate list. */
+template<typename X, typename Y>
+void print_coordinates(const std::vector<std::pair<X, Y>>& points, std::ostream& out) {
+  for (const auto& [x, y] : points) {
+    out << "(" << x << ", " << y << ")\n";
+  }
+}
+
+/* Writes the gap distribution of a configuration to the sink (if not null). */
+inline void write_gap_distribution(
+  ResultSink* sink,
+  const std::string& experiment,
+  long long param,
+  uint64_t n,
+  uint64_t m,
+  const GapStatistics& statistics) {
+  if (sink == nullptr) return;
+  for (int gap = statistics.getMinGap(); gap <= statistics.getMaxGap(); ++gap) {
+    size_t count = statistics.getGapCount(gap);
+    if (count > 0) sink->write({ experiment, param, n, m, gap, count });
+  }
+}
+
+/* Prints the gap distributions of a configuration of the noisy driver
+   after the given numbers of balls, with a "m : " line before each if there
+   are several, where `interval` is the interval of the last mean gap. */
+inline void print_noise_entry(
+  const std::vector<uint64_t>& horizons,
+  const std::vector<GapStatistics>& statistics,
+  const ConfidenceInterval& interval,
+  bool sequential,
+  std::ostream& out) {
+  for (size_t i = 0; i + 1 < statistics.size(); ++i) {
+    out << "m : " << horizons[i] << "\n";
+    print_gap_distribution(statistics[i], sequential, out);
+    ConfidenceInterval earlier_interval = statistics[i].getMeanInterval();
+    out << "Mean : " << earlier_interval.mean << " [" << earlier_interval.lower << ", " << earlier_interval.upper << "]\n";
+  }
+  if (statistics.size() > 1) {
+    out << "m : " << horizons.back() << "\n";
+  }
+  print_gap_distribution(statistics.back(), sequential, out);
+  out << "Mean : " << interval.mean << " [" << interval.lower << ", " << interval.upper << "]\n";
+}
+
+/* Prints the entry of Table 12.4 for a batch size, with the Two-Choice
+   gap distributions after the given numbers of balls. */
+inline void print_batched_entry(
+  const std::vector<uint64_t>& horizons,
+  const std::vector<GapStatistics>& two_choice_statistics,
+  const GapStatistics& one_choice_statistics,
+  bool sequential,
+  std::ostream& out) {
+  for (size_t i = 0; i < horizons.size(); ++i) {
+    if (horizons.size() > 1) {
+      out << "Two-Choice (m = " << horizons[i] << "):\n";
+    } else {
+      out << "Two-Choice:\n";
+    }
+    print_gap_distribution(two_choice_statistics[i], sequential, out);
+  }
+  out << "One-Choice:\n";
+  print_gap_distribution(one_choice_statistics, sequential, out);
+  out << "\n";
+}
+
+/* Prints Figure 12.2 from the mean gaps against the batch size. */
+inline void print_batched_figure(
+  const std::vector<std::pair<int, int>>& one_choice_plot,
+  const std::vector<std::pair<int, int>>& two_choice_plot,
+  std::ostream& out) {
+  out << "=== Figure 12.2 ===\n";
+  out << "One-Choice:\n";
+  print_coordinates(one_choice_plot, out);
+  out << "Two-Choice:\n";
+  print_coordinates(two_choice_plot, out);
+}
+
+/* Experiments of the noisy driver and their headings, in the order the
+   driver runs them. */
+const std::vector<std::pair<std::string, std::string>> kNoiseSweepHeadings = {
+  { "sigma-noisy", "Sigma-noise: " },
+  { "g-bounded", "g-Bounded: " },
+  { "g-myopic", "g-Myopic: " }
+};
+
+/* Prints the tables of the (merged) result rows in the layout of the
+   drivers: the noisy experiments as printed by `normal_noise` and the
+   batched ones as printed by `batched_experiments` (in independent runs
+   mode, and without the burn-in and run count lines). This reconstructs the
+   output of a sweep from the result files of its shards. */
+inline void format_driver_tables(const std::vector<ResultRow>& rows, std::ostream& out) {
+  // Statistics by experiment, n, parameter and m.
+  using Horizons = std::map<uint64_t, GapStatistics>;
+  std::map<std::string, std::map<uint64_t, std::map<long long, Horizons>>> experiments;
+  for (const auto& row : merge_results(rows)) {
+    experiments[row.experiment][row.n][row.param][row.m].add(row.gap, row.count);
+  }
+  auto horizons_of = [](const Horizons& statistics, std::vector<uint64_t>& horizons, std::vector<GapStatistics>& values) {
+    for (const auto& [m, value] : statistics) {
+      horizons.push_back(m);
+      values.push_back(value);
+    }
+  };
+
+  std::vector<std::pair<std::string, std::string>> sweeps = kNoiseSweepHeadings;
+  for (const auto& [experiment, results] : experiments) {
+    bool known = std::any_of(sweeps.begin(), sweeps.end(), [&experiment](const auto& sweep) { return sweep.first == experiment; });
+    if (!known && experiment.rfind("batched-", 0) != 0) sweeps.push_back({ experiment, experiment + ": " });
+  }
+  for (const auto& [experiment, heading] : sweeps) {
+    auto it = experiments.find(experiment);
+    if (it == experiments.end()) continue;
+    out << heading << "\n";
+    for (const auto& [n, params] : it->second) {
+      out << "n : " << n << "\n\n";
+      for (const auto& [param, statistics] : params) {
+        out << "Value : " << param << "\n";
+        std::vector<uint64_t> horizons;
+        std::vector<GapStatistics> values;
+        horizons_of(statistics, horizons, values);
+        print_noise_entry(horizons, values, values.back().getMeanInterval(), false, out);
+      }
+    }
+  }
+
+  const auto& two_choice = experiments["batched-two-choice"];
+  const auto& one_choice = experiments["batched-one-choice"];
+  for (const auto& [n, batch_sizes] : two_choice) {
+    std::vector<std::pair<int, int>> one_choice_plot, two_choice_plot;
+    out << "=== Table 12.4 ===\n";
+    for (const auto& [batch_size, statistics] : batch_sizes) {
+      out << "Batch-size (b) : " << batch_size << "\n";
+      std::vector<uint64_t> horizons;
+      std::vector<GapStatistics> values;
+      horizons_of(statistics, horizons, values);
+      GapStatistics one_choice_statistics;
+      auto bins = one_choice.find(n);
+      if (bins != one_choice.end() && bins->second.count(batch_size) > 0) {
+        for (const auto& [m, value] : bins->second.at(batch_size)) {
+          one_choice_statistics.merge(value);
+        }
+      }
+      print_batched_entry(horizons, values, one_choice_statistics, false, out);
+      one_choice_plot.push_back({ int(batch_size), one_choice_statistics.getMean() });
+      two_choice_plot.push_back({ int(batch_size), values.back().getMean() });
+    }
+    print_batched_figure(one_choice_plot, two_choice_plot, out);
+  }
+}
+
+/* Prints the tables of the (merged) result rows, grouped by experiment, n
+   and m, followed by the coordinate list of the mean gap against the
+   parameter for each group. */
+inline void format_results(const std::vector<ResultRow>& rows, std::ostream& out) {
+  std::map<std::tuple<std::string, uint64_t, uint64_t>, std::map<long long, GapStatistics>> groups;
+  for (const auto& row : merge_results(rows)) {
+    groups[{ row.experiment, row.n, row.m }][row.param].add(row.gap, row.count);
+  }
+  for (const auto& [group, configurations] : groups) {
+    const auto& [experiment, n, m] = group;
+    out << experiment << " (n : " << n << ", m : " << m << ")\n\n";
+    std::vector<std::pair<long long, double>> plot;
+    for (const auto& [param, statistics] : configurations) {
+      out << "Value : " << param << "\n";
+      print_gap_distribution(statistics, false, out);
+      out << "Mean : " << statistics.getMean() << "\n";
+      plot.push_back({ param, statistics.getMean() });
+    }
+    out << "Coordinates:\n";
+    print_coordinates(plot, out);
+    out << "\n";
+  }
+}
+
+#endif  // NOISE22_LATEX_H_
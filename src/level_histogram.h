@@ -0,0 +1,157 @@
+/* Incrementally maintained histogram of the load levels of a process. */
+#ifndef NOISE22_LEVEL_HISTOGRAM_H_
+#define NOISE22_LEVEL_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "load_view.h"
+
+/* Observer that maintains, for every load level k between the minimum and
+   the maximum load, the number of bins with load at most k. Since loads
+   only increase, moving a bin from load L to load L + c only decrements
+   the c entries for L, ..., L + c - 1, so updates take O(1) time per ball.
+   Then:
+     - the minimum and maximum loads, the gap and the number of bins at a
+       level (or below a level) take O(1) time, and
+     - any load quantile takes O(log(max - min)) time by binary search.
+
+   The levels are stored in a circular buffer indexed by the load, which
+   only needs max - min + 1 (i.e., O(gap)) entries. Use it as the observer
+   of a process, e.g., `TwoSampleProcess<Generator, LevelHistogram>(n,
+   decider, LevelHistogram(n))`, and query it with `getObserver()`. */
+class LevelHistogram : public NoObserver {
+public:
+
+  explicit LevelHistogram(size_t num_bins)
+    : num_bins_(num_bins), total_balls_(0), min_load_(0), max_load_(0), at_most_(kInitialCapacity, 0), mask_(kInitialCapacity - 1) {
+    at_most_[0] = num_bins;
+  }
+
+  void onAllocation(size_t bin, size_t old_load, size_t new_load) {
+    total_balls_ += new_load - old_load;
+    if (new_load > max_load_) {
+      reserve(new_load - min_load_ + 1);
+      for (size_t load = max_load_ + 1; load <= new_load; ++load) {
+        at_most_[load & mask_] = num_bins_;
+      }
+      max_load_ = new_load;
+    }
+    for (size_t load = old_load; load < new_load; ++load) {
+      --at_most_[load & mask_];
+    }
+    while (at_most_[min_load_ & mask_] == 0) {
+      ++min_load_;
+    }
+  }
+
+  /* Rebuilds the histogram from the loads in O(n) time. */
+  void onRestore(LoadView loads) {
+    min_load_ = loads[0];
+    max_load_ = loads[0];
+    total_balls_ = 0;
+    for (auto load : loads) {
+      min_load_ = std::min(min_load_, load);
+      max_load_ = std::max(max_load_, load);
+      total_balls_ += load;
+    }
+    std::vector<uint64_t> counts(max_load_ - min_load_ + 1, 0);
+    for (auto load : loads) {
+      ++counts[load - min_load_];
+    }
+    std::fill(at_most_.begin(), at_most_.end(), 0);
+    reserve(counts.size());
+    uint64_t cumulative = 0;
+    for (size_t level = 0; level < counts.size(); ++level) {
+      cumulative += counts[level];
+      at_most_[(min_load_ + level) & mask_] = cumulative;
+    }
+  }
+
+  size_t getMinLoad() const {
+    return min_load_;
+  }
+
+  size_t getMaxLoad() const {
+    return max_load_;
+  }
+
+  /* Returns max load - average load. */
+  double getGap() const {
+    return max_load_ - getAverageLoad();
+  }
+
+  /* Returns average load - min load. */
+  double getUnderload() const {
+    return getAverageLoad() - min_load_;
+  }
+
+  double getAverageLoad() const {
+    return total_balls_ / double(num_bins_);
+  }
+
+  /* Returns the number of bins with load at most `load`. */
+  uint64_t getBinsAtMost(size_t load) const {
+    if (load < min_load_) return 0;
+    if (load >= max_load_) return num_bins_;
+    return at_most_[load & mask_];
+  }
+
+  /* Returns the number of bins with load exactly `load`. */
+  uint64_t getBinsAt(size_t load) const {
+    return getBinsAtMost(load) - (load == 0 ? 0 : getBinsAtMost(load - 1));
+  }
+
+  /* Returns the number of bins with load strictly below the average. */
+  uint64_t getUnderloadedBins() const {
+    double average = getAverageLoad();
+    size_t ceiling = size_t(std::ceil(average));
+    return ceiling == 0 ? 0 : getBinsAtMost(ceiling - 1);
+  }
+
+  /* Returns the smallest load such that at least a `q` fraction of the bins
+     have at most that load (e.g., q = 0.5 for the median load). */
+  size_t getQuantile(double q) const {
+    uint64_t target = uint64_t(std::ceil(q * num_bins_));
+    size_t low = min_load_, high = max_load_;
+    while (low < high) {
+      size_t middle = low + (high - low) / 2;
+      if (at_most_[middle & mask_] >= target) {
+        high = middle;
+      } else {
+        low = middle + 1;
+      }
+    }
+    return low;
+  }
+
+private:
+
+  static constexpr size_t kInitialCapacity = 64;
+
+  /* Grows the circular buffer to hold at least `levels` levels. */
+  void reserve(size_t levels) {
+    if (levels <= at_most_.size()) return;
+    size_t capacity = at_most_.size();
+    while (capacity < levels) capacity *= 2;
+    std::vector<uint64_t> grown(capacity, 0);
+    for (size_t load = min_load_; load <= max_load_; ++load) {
+      grown[load & (capacity - 1)] = at_most_[load & mask_];
+    }
+    at_most_ = std::move(grown);
+    mask_ = capacity - 1;
+  }
+
+  const size_t num_bins_;
+  uint64_t total_balls_;
+  size_t min_load_;
+  size_t max_load_;
+
+  /* Number of bins with load at most k, at index k mod the capacity. */
+  std::vector<uint64_t> at_most_;
+  size_t mask_;
+};
+
+#endif  // NOISE22_LEVEL_HISTOGRAM_H_
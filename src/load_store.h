@@ -0,0 +1,388 @@
+/* Storage of the load vectors of the processes.
+
+   The loads are kept in zeroed memory that is mapped lazily, so creating a
+   process with 10^9 bins does not touch (or zero) any page until a bin in
+   it is first used. For large n, the random accesses of the allocations
+   miss the TLB on almost every ball with 4 KB pages, which huge pages
+   avoid:
+     - `kTransparentHuge` aligns the mapping to 2 MB and asks the kernel to
+       back it with transparent huge pages (`madvise(MADV_HUGEPAGE)`),
+     - `kHuge2M` and `kHuge1G` use explicit huge pages (`MAP_HUGETLB`),
+       which have to be reserved by the administrator (e.g., with
+       `vm.nr_hugepages`), and fall back to transparent huge pages if none
+       are available.
+   For n beyond the memory, `kFile` keeps the loads in a sparse (unlinked)
+   file in `store_directory()`, whose pages are cached by the kernel: the
+   recently used ones stay in memory and the others are written back.
+   Stores smaller than a huge page use the next smaller page size (or
+   memory). Where mmap is not available, all modes use `calloc`. Mapped
+   stores of threads pinned with `pin_worker_thread` are bound to the node
+   of the thread (see numa.h).
+
+   `clone()` copies stores of at least `copy_on_write_threshold()` bytes
+   copy-on-write: the contents are written once to an unlinked file (a
+   memfd on Linux) and every clone is a private mapping of it, so a clone
+   costs O(1) and only the pages it later modifies are copied (as 4 KB
+   pages, also for the huge page modes). A store that has not been
+   modified since its last clone is cloned again from the same file. File
+   stores (`kFile`) are always copied, as the modified pages of a private
+   mapping would no longer be written back to the file. */
+#ifndef NOISE22_LOAD_STORE_H_
+#define NOISE22_LOAD_STORE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "numa.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define NOISE22_HAS_MMAP 1
+#endif
+
+/* Pages backing a load store. */
+enum class PageMode {
+  /* Zeroed memory from `calloc`, which maps large blocks lazily as well. */
+  kDefault,
+  kTransparentHuge,
+  kHuge2M,
+  kHuge1G,
+  kFile
+};
+
+/* Returns the page mode used by the load stores that do not specify one. */
+inline PageMode& default_page_mode() {
+  static PageMode mode = PageMode::kDefault;
+  return mode;
+}
+
+/* Returns the directory of the files of the `kFile` load stores. */
+inline std::string& store_directory() {
+  static std::string directory = ".";
+  return directory;
+}
+
+/* Returns the size in bytes from which `LoadStore::clone()` shares the
+   pages of the store copy-on-write instead of copying them. */
+inline size_t& copy_on_write_threshold() {
+  static size_t threshold = size_t(1) << 26;
+  return threshold;
+}
+
+/* Parses "default", "transparent", "2m", "1g" or "file". */
+inline PageMode parse_page_mode(const std::string& name) {
+  if (name == "default") return PageMode::kDefault;
+  if (name == "transparent") return PageMode::kTransparentHuge;
+  if (name == "2m") return PageMode::kHuge2M;
+  if (name == "1g") return PageMode::kHuge1G;
+  if (name == "file") return PageMode::kFile;
+  throw std::runtime_error("Unknown page mode " + name);
+}
+
+namespace internal {
+
+constexpr size_t kHugePageSize = size_t(1) << 21;
+constexpr size_t kGiantPageSize = size_t(1) << 30;
+
+/* Returns the mode used for a store of `bytes` bytes with the given mode,
+   which only uses pages that are not larger than the store. */
+inline PageMode effective_page_mode(size_t bytes, PageMode mode) {
+#ifdef NOISE22_HAS_MMAP
+  if (mode == PageMode::kHuge1G && bytes < kGiantPageSize) mode = PageMode::kHuge2M;
+  if (mode != PageMode::kDefault && bytes < kHugePageSize) mode = PageMode::kDefault;
+  return mode;
+#else
+  return PageMode::kDefault;
+#endif
+}
+
+/* Returns the size of the mapping for a store of `bytes` bytes. */
+inline size_t mapping_length(size_t bytes, PageMode mode) {
+  size_t page = mode == PageMode::kHuge1G ? kGiantPageSize : kHugePageSize;
+  return (bytes + page - 1) / page * page;
+}
+
+#ifdef NOISE22_HAS_MMAP
+/* Returns the descriptor of a new (unlinked) file in `store_directory()`. */
+inline int create_store_file() {
+  std::string pattern = store_directory() + "/loads-XXXXXX";
+  std::vector<char> path(pattern.begin(), pattern.end());
+  path.push_back('\0');
+  int fd = mkstemp(path.data());
+  if (fd < 0) throw std::runtime_error("Failed to create a load store in " + store_directory());
+  // The file is removed as soon as it is unmapped.
+  unlink(path.data());
+  return fd;
+}
+#endif
+
+/* Returns `bytes` zeroed bytes, whose pages are only backed when touched. */
+inline void* allocate_pages(size_t bytes, PageMode mode) {
+  mode = effective_page_mode(bytes, mode);
+  if (mode == PageMode::kDefault) {
+    void* data = std::calloc(bytes, 1);
+    if (data == nullptr) throw std::bad_alloc();
+    return data;
+  }
+#ifdef NOISE22_HAS_MMAP
+  size_t length = mapping_length(bytes, mode);
+  if (mode == PageMode::kFile) {
+    int fd = create_store_file();
+    void* data = ftruncate(fd, length) == 0
+      ? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+      : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) throw std::runtime_error("Failed to map a load store in " + store_directory());
+    bind_to_numa_node(data, length, preferred_numa_node());
+    return data;
+  }
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  if (mode != PageMode::kTransparentHuge) {
+    int page_shift = mode == PageMode::kHuge1G ? 30 : 21;
+    void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+    if (data != MAP_FAILED) {
+      bind_to_numa_node(data, length, preferred_numa_node());
+      return data;
+    }
+  }
+#endif
+  // Maps one more huge page than needed and unmaps the ends, so that the
+  // store starts at a huge page boundary.
+  char* base = static_cast<char*>(mmap(nullptr, length + kHugePageSize, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (base == MAP_FAILED) throw std::bad_alloc();
+  size_t head = (kHugePageSize - reinterpret_cast<uintptr_t>(base) % kHugePageSize) % kHugePageSize;
+  if (head > 0) munmap(base, head);
+  if (head < kHugePageSize) munmap(base + head + length, kHugePageSize - head);
+#ifdef MADV_HUGEPAGE
+  madvise(base + head, length, MADV_HUGEPAGE);
+#endif
+  bind_to_numa_node(base + head, length, preferred_numa_node());
+  return base + head;
+#else
+  return nullptr;
+#endif
+}
+
+/* Frees memory returned by `allocate_pages(bytes, mode)`. */
+inline void free_pages(void* data, size_t bytes, PageMode mode) {
+  mode = effective_page_mode(bytes, mode);
+  if (mode == PageMode::kDefault) {
+    std::free(data);
+    return;
+  }
+#ifdef NOISE22_HAS_MMAP
+  munmap(data, mapping_length(bytes, mode));
+#endif
+}
+
+#ifdef NOISE22_HAS_MMAP
+/* Contents of a store, written once to an unlinked file, of which the
+   copy-on-write clones of the store are private mappings. */
+class PageImage {
+public:
+
+  PageImage(const void* data, size_t bytes) : fd_(-1), length_(page_length(bytes)) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd_ = memfd_create("loads", MFD_CLOEXEC);
+#endif
+    if (fd_ < 0) fd_ = create_store_file();
+    const char* next = static_cast<const char*>(data);
+    size_t remaining = bytes;
+    bool written = ftruncate(fd_, length_) == 0;
+    while (written && remaining > 0) {
+      ssize_t count = write(fd_, next, remaining);
+      written = count > 0;
+      if (written) {
+        next += count;
+        remaining -= count;
+      }
+    }
+    if (!written) {
+      close(fd_);
+      throw std::runtime_error("Failed to write a copy-on-write load store");
+    }
+  }
+
+  PageImage(const PageImage&) = delete;
+  PageImage& operator=(const PageImage&) = delete;
+
+  ~PageImage() {
+    close(fd_);
+  }
+
+  /* Maps the contents privately (at `address` if it is not null, replacing
+     the mapping there). */
+  void* map(void* address = nullptr) const {
+    void* data = mmap(address, length_, PROT_READ | PROT_WRITE, MAP_PRIVATE | (address == nullptr ? 0 : MAP_FIXED), fd_, 0);
+    if (data == MAP_FAILED) throw std::runtime_error("Failed to map a copy-on-write load store");
+    bind_to_numa_node(data, length_, preferred_numa_node());
+    return data;
+  }
+
+  /* Returns the length of the mappings of a store of `bytes` bytes. */
+  static size_t page_length(size_t bytes) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (bytes + page - 1) / page * page;
+  }
+
+private:
+
+  int fd_;
+  size_t length_;
+};
+#endif
+
+}  // namespace internal
+
+/* Fixed-size array of loads (or other counters), initially all zero. */
+template<typename T>
+class LoadStore {
+  static_assert(std::is_trivially_copyable<T>::value, "Load stores hold plain counters.");
+
+public:
+
+  /* Creates a store of `size` zeros, without touching its memory. */
+  explicit LoadStore(size_t size, PageMode mode = default_page_mode())
+    : data_(size == 0 ? nullptr : static_cast<T*>(internal::allocate_pages(size * sizeof(T), mode))), size_(size), mode_(mode),
+      mapped_(false), unmodified_(false) {
+
+  }
+
+  LoadStore(const LoadStore& other) : LoadStore(other.size_, other.mode_) {
+    std::copy(other.begin(), other.end(), data_);
+  }
+
+  LoadStore(LoadStore&& other) noexcept
+    : data_(other.data_), size_(other.size_), mode_(other.mode_), mapped_(other.mapped_),
+      image_(std::move(other.image_)), unmodified_(other.unmodified_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  LoadStore& operator=(LoadStore other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(mode_, other.mode_);
+    std::swap(mapped_, other.mapped_);
+    std::swap(image_, other.image_);
+    std::swap(unmodified_, other.unmodified_);
+    return *this;
+  }
+
+  ~LoadStore() {
+    if (data_ == nullptr) return;
+#ifdef NOISE22_HAS_MMAP
+    if (mapped_) {
+      munmap(data_, internal::PageImage::page_length(size_ * sizeof(T)));
+      return;
+    }
+#endif
+    internal::free_pages(data_, size_ * sizeof(T), mode_);
+  }
+
+  /* Returns a copy of the store, which shares the pages copy-on-write if
+     the store has at least `copy_on_write_threshold()` bytes (see above).
+     A store that is itself such a clone is then remapped to the shared
+     contents as well, which keeps its address but releases its modified
+     pages. */
+  LoadStore clone() const {
+#ifdef NOISE22_HAS_MMAP
+    size_t bytes = size_ * sizeof(T);
+    if (bytes == 0 || bytes < copy_on_write_threshold() || mode_ == PageMode::kFile) return LoadStore(*this);
+    if (image_ == nullptr || !unmodified_) {
+      image_ = std::make_shared<const internal::PageImage>(data_, bytes);
+      if (mapped_) image_->map(data_);
+      unmodified_ = true;
+    }
+    return LoadStore(image_, size_, mode_);
+#else
+    return LoadStore(*this);
+#endif
+  }
+
+  T& operator[](size_t i) {
+    unmodified_ = false;
+    return data_[i];
+  }
+
+  const T& operator[](size_t i) const {
+    return data_[i];
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  T* data() {
+    unmodified_ = false;
+    return data_;
+  }
+
+  const T* data() const {
+    return data_;
+  }
+
+  T* begin() {
+    unmodified_ = false;
+    return data_;
+  }
+
+  T* end() {
+    unmodified_ = false;
+    return data_ + size_;
+  }
+
+  const T* begin() const {
+    return data_;
+  }
+
+  const T* end() const {
+    return data_ + size_;
+  }
+
+  PageMode getPageMode() const {
+    return mode_;
+  }
+
+  /* Sets all entries to zero, reusing the memory. */
+  void clear() {
+    std::fill(begin(), end(), T());
+  }
+
+private:
+
+#ifdef NOISE22_HAS_MMAP
+  /* Creates a private mapping of the shared contents `image`. */
+  LoadStore(std::shared_ptr<const internal::PageImage> image, size_t size, PageMode mode)
+    : data_(static_cast<T*>(image->map())), size_(size), mode_(mode), mapped_(true), image_(std::move(image)), unmodified_(true) {
+
+  }
+#endif
+
+  T* data_;
+  size_t size_;
+  PageMode mode_;
+  /* Whether `data_` is a private mapping of a `PageImage`. */
+  bool mapped_;
+#ifdef NOISE22_HAS_MMAP
+  /* The shared contents of the last copy-on-write clone, which equal the
+     store while `unmodified_` (which every non-const access clears). */
+  mutable std::shared_ptr<const internal::PageImage> image_;
+#else
+  std::shared_ptr<const void> image_;
+#endif
+  mutable bool unmodified_;
+};
+
+#endif  // NOISE22_LOAD_STORE_H_
@@ -0,0 +1,83 @@
+/* Read-only views of the load vector of a process, which avoid copying it. */
+#ifndef NOISE22_LOAD_VIEW_H_
+#define NOISE22_LOAD_VIEW_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "load_store.h"
+
+/* A read-only view of a contiguous range of loads (like a std::span). It
+   is only valid while the process it was taken from is unchanged. */
+class LoadView {
+public:
+
+  LoadView(const size_t* data, size_t size) : data_(data), size_(size) {
+
+  }
+
+  LoadView(const std::vector<size_t>& loads) : data_(loads.data()), size_(loads.size()) {
+
+  }
+
+  LoadView(const LoadStore<size_t>& loads) : data_(loads.data()), size_(loads.size()) {
+
+  }
+
+  size_t operator[](size_t i) const {
+    return data_[i];
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  const size_t* data() const {
+    return data_;
+  }
+
+  const size_t* begin() const {
+    return data_;
+  }
+
+  const size_t* end() const {
+    return data_ + size_;
+  }
+
+  /* Returns the view of the `count` loads starting at `offset`. */
+  LoadView subview(size_t offset, size_t count) const {
+    return LoadView(data_ + offset, count);
+  }
+
+private:
+
+  const size_t* data_;
+  size_t size_;
+};
+
+/* Observer of the allocations of a process, which is a template parameter
+   of the processes so that its calls are inlined. This one ignores every
+   event, so it compiles away. Custom observers derive from it and hide the
+   hooks they need. */
+struct NoObserver {
+  /* Called as onAllocation(bin, old_load, new_load) after `bin` received
+     balls (one, or in the batched setting, all its balls of a batch) and
+     its load went from `old_load` to `new_load`. */
+  void onAllocation(size_t, size_t, size_t) {
+
+  }
+
+  /* Called as onBatchMerge(loads) in the batched setting after the batch
+     has been merged into the load vector. */
+  void onBatchMerge(LoadView) {
+
+  }
+
+  /* Called as onRestore(loads) after the load vector was replaced (e.g.,
+     from a checkpoint). */
+  void onRestore(LoadView) {
+
+  }
+};
+
+#endif  // NOISE22_LOAD_VIEW_H_
@@ -0,0 +1,70 @@
+/* Read-only access to the contents of a file without copying them. */
+#ifndef NOISE22_MAPPED_FILE_H_
+#define NOISE22_MAPPED_FILE_H_
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NOISE22_HAS_MMAP 1
+#endif
+
+/* Contents of a file, which is memory mapped where supported (and read
+   into memory otherwise). */
+class MappedFile {
+public:
+
+  explicit MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+#ifdef NOISE22_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open " + path);
+    struct stat info;
+    fstat(fd, &info);
+    size_ = info.st_size;
+    void* mapping = size_ == 0 ? MAP_FAILED : mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Failed to map " + path);
+    data_ = static_cast<const char*>(mapping);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Failed to open " + path);
+    buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#ifdef NOISE22_HAS_MMAP
+    munmap(const_cast<char*>(data_), size_);
+#endif
+  }
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+private:
+
+  const char* data_;
+  size_t size_;
+#ifndef NOISE22_HAS_MMAP
+  std::vector<char> buffer_;
+#endif
+};
+
+#endif  // NOISE22_MAPPED_FILE_H_
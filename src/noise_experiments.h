@@ -0,0 +1,473 @@
+/* Sweeps of the Two-Sample process over the parameter of a decider, which
+   produce the tables and figures of the noisy settings. */
+#ifndef NOISE22_NOISE_EXPERIMENTS_H_
+#define NOISE22_NOISE_EXPERIMENTS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "deciders.h"
+#include "horizons.h"
+#include "journal.h"
+#include "latex.h"
+#include "progress.h"
+#include "result_cache.h"
+#include "result_sink.h"
+#include "run_store.h"
+#include "scheduler.h"
+#include "seeding.h"
+#include "sharding.h"
+#include "stationary.h"
+#include "statistics.h"
+#include "trajectory.h"
+#include "two_sample_process.h"
+
+/* How the gap samples of each configuration are collected. */
+enum class SamplingMode {
+  /* Every run starts from an empty load vector and is measured after m balls. */
+  kIndependentRuns,
+  /* A single trajectory is warmed up for m balls and then its gap is sampled
+     every `sample_interval` balls. The samples are correlated, so the
+     confidence interval of the mean gap is corrected with `interval_method`. */
+  kStationary
+};
+
+/* Options for collecting the gap samples in `normal_noise`. */
+struct SamplingOptions {
+  SamplingMode mode = SamplingMode::kStationary;
+
+  /* Number of samples per configuration in the stationary mode. */
+  int samples = 100;
+
+  /* Rule deciding the number of runs per configuration in the independent
+     runs mode. */
+  SequentialStopping stopping;
+
+  /* Number of balls between consecutive samples in the stationary mode,
+     where 0 means m balls. */
+  size_t sample_interval = 0;
+
+  /* Correction used for the confidence interval in the stationary mode. */
+  IntervalMethod interval_method = IntervalMethod::kBatchMeans;
+
+  /* Whether the stationary mode prints the mean gap and its interval. This
+     is off by default, so that the default output has the format of the
+     paper's tables. */
+  bool print_interval = false;
+
+  /* Whether to end the burn-in as soon as the `BurnInDetector` declares the
+     trajectory mixed (checking every n/4 balls), instead of after m balls. */
+  bool detect_burn_in = false;
+
+  /* Whether, in the stationary mode, each parameter value continues from
+     the final state of the previous one. Neighbouring parameters have
+     similar stationary distributions, so the trajectory only needs to
+     re-equilibrate until the `BurnInDetector` declares it mixed (which is
+     usually much shorter than m balls). On a restart, a journaled parameter
+     value is only skipped if the next one can continue from its final state,
+     i.e., if that was checkpointed (with `checkpoint_dir`), and otherwise it
+     is simulated again. */
+  bool continuation = false;
+
+  /* If not empty, the warm-up of each single-trajectory configuration is
+     resumed from (and saved to) a checkpoint in this directory. */
+  std::string checkpoint_dir;
+
+  /* Number of balls between checkpoints during the warm-up (0 for only
+     saving a checkpoint at the end of it). */
+  size_t checkpoint_interval = 0;
+
+  /* Seed from which the seeds of the runs (and trajectories) are derived. */
+  uint64_t seed = 0;
+
+  /* If not null, completed runs are appended to this journal and runs that
+     are already in it are not repeated. */
+  Journal* journal = nullptr;
+
+  /* If not null, independent runs are looked up in (and added to) this
+     cache, so only the runs missing from it are computed. */
+  ResultCache* cache = nullptr;
+
+  /* If not null, the gap distribution of every configuration is written to
+     this sink. */
+  ResultSink* results = nullptr;
+
+  /* If not empty, a compressed snapshot of the load vector is saved to
+     this directory at every sample in the stationary mode. */
+  std::string snapshot_dir;
+
+  /* If not empty, the trajectory of the first independent run of each
+     configuration is recorded (when it is simulated) to a file in this
+     directory, sampled as given by `recorder` (where an interval of 0
+     means n balls). */
+  std::string trajectory_dir;
+  RecorderOptions recorder;
+
+  /* Numbers of balls (as multiples of n) at which the gap is measured
+     within each independent run. If empty, it is only measured after m
+     balls. Burn-in detection only applies to a single horizon. */
+  std::vector<long long> horizons;
+
+  /* Numbers of bins to run the experiments for. If empty, these are
+     10^4, 5 * 10^4 and 10^5. */
+  std::vector<long long> bins;
+
+  /* If not null, the progress of the warm-ups and of the independent runs
+     is reported to it. */
+  ProgressReporter* progress = nullptr;
+
+  /* Part of the independent runs computed by this process. */
+  Shard shard;
+
+  /* Stream the distributions are printed to. */
+  std::ostream* out = &std::cout;
+};
+
+/* Returns the path of the checkpoint of the trajectory of the given
+   configuration (warmed up for m balls by a `Generator` with the given
+   seed), or the empty string if checkpoints are disabled. */
+template<typename Generator>
+std::string checkpoint_path(const SamplingOptions& options, const std::string& name, uint64_t n, int param, uint64_t m, uint64_t seed) {
+  if (options.checkpoint_dir.empty()) return "";
+  return options.checkpoint_dir + "/" + checkpoint_file_name(name + "_n" + std::to_string(n) + "_" + std::to_string(param), m,
+                                                             generator_name<Generator>(), seed, options.detect_burn_in);
+}
+
+/* Returns the numbers of bins to run the experiments for. */
+inline std::vector<uint64_t> bin_counts(const SamplingOptions& options) {
+  if (options.bins.empty()) return { 10'000, 50'000, 100'000 };
+  return std::vector<uint64_t>(options.bins.begin(), options.bins.end());
+}
+
+/* Runs the warm-up of a single trajectory with m balls, or until the
+   trajectory is detected to have mixed. If `path` is not empty, the
+   warm-up resumes from the checkpoint at `path` (if it exists) and the
+   state is saved there at the end of the warm-up (and periodically). */
+template<typename Generator>
+BurnInResult warm_up_trajectory(
+  TwoSampleProcess<Generator>& process,
+  Generator& generator,
+  uint64_t n,
+  uint64_t m,
+  const SamplingOptions& options,
+  const std::string& path) {
+  if (options.detect_burn_in) {
+    if (!path.empty() && checkpoint_exists(path)) {
+      CheckpointReader checkpoint(path);
+      process.restoreCheckpoint(checkpoint, generator);
+      return checkpoint.getBurnIn();
+    }
+    BurnInResult result = burn_in(process, generator, std::max<uint64_t>(1, n / 4), m);
+    if (!path.empty()) {
+      process.saveCheckpoint(path, generator, result);
+    }
+    return result;
+  }
+  if (!path.empty()) {
+    uint64_t rounds = checkpointed_warm_up(process, generator, path, m, options.checkpoint_interval);
+    return { rounds, 0, false };
+  }
+  if (options.progress != nullptr) {
+    options.progress->start("Warm-up (n = " + std::to_string(n) + ")", m);
+  }
+  run_with_progress(process, generator, m, options.progress);
+  return { m, 0, false };
+}
+
+template<typename Generator>
+void normal_noise(
+  const std::string& name,
+  uint64_t m_batches, 
+  const std::vector<int>& param_values, 
+  std::function<DeciderFn<Generator>(int)> decider_producer,
+  const SamplingOptions& options = SamplingOptions()) {
+  std::ostream& out = *options.out;
+  for (auto n : bin_counts(options)) {
+    std::vector<std::pair<int, int>> coordinate_plot;
+    // Final state of the trajectory for the previous parameter value.
+    std::optional<TwoSampleProcess<Generator>> previous;
+    // Hash of the parameter values so far, which determine the state of a
+    // continued trajectory.
+    uint64_t chain = 0;
+    out << "n : " << n << "\n\n";
+    for (const auto& param : param_values) {
+      if (interrupted()) return;
+      out << "Value : " << param << "\n";
+      uint64_t m = m_batches * n;
+      std::vector<double> gaps;
+      // Sum of the mixing points of the simulated runs (the runs served from
+      // the journal or cache have none).
+      double mixing_sum = 0.0;
+      size_t mixing_runs = 0;
+      GapStatistics statistics;
+      // Horizons (in balls) of the independent runs and the statistics for
+      // all but the last of them.
+      std::vector<uint64_t> horizons;
+      std::vector<GapStatistics> earlier_horizons;
+      if (options.mode == SamplingMode::kStationary) {
+        size_t interval = options.sample_interval == 0 ? m : options.sample_interval;
+        uint64_t seed = derive_seed(options.seed, { hash_string(name), uint64_t(param), n });
+        chain = derive_seed(chain, { uint64_t(param) });
+        std::string variant = generator_name<Generator>();
+        if (options.detect_burn_in) variant += ",detect-burn-in";
+        if (options.continuation) variant += ",continuation-" + std::to_string(chain);
+        // With the continuation, the final state is checkpointed so that the
+        // next parameter value can continue from it after a restart.
+        std::string final_path = options.continuation && !options.checkpoint_dir.empty()
+          ? options.checkpoint_dir + "/" + checkpoint_file_name(name + "_n" + std::to_string(n) + "_" + std::to_string(param) + "_continuation-"
+              + std::to_string(chain), m + std::max(options.samples - 1, 0) * interval, generator_name<Generator>(), seed, options.detect_burn_in)
+          : "";
+        bool needs_final_state = options.continuation && &param != &param_values.back();
+        // Reuse the trajectory from the journal if all its samples are there
+        // (and its final state, if the next parameter value continues from it).
+        for (int sample = 0; options.journal != nullptr && sample < options.samples; ++sample) {
+          const RunRecord* record = options.journal->find(name, param, n, m + sample * interval, sample, seed, variant);
+          if (record == nullptr) break;
+          gaps.push_back(record->gap);
+        }
+        bool journaled = gaps.size() == size_t(options.samples);
+        if (journaled && needs_final_state && (final_path.empty() || !checkpoint_exists(final_path))) {
+          journaled = false;
+        }
+        if (journaled) {
+          if (needs_final_state) {
+            Generator final_generator;
+            previous.emplace(n, decider_producer(param));
+            previous->restoreCheckpoint(CheckpointReader(final_path), final_generator);
+          } else {
+            previous.reset();
+          }
+        } else {
+          gaps.clear();
+          Generator generator(seed);
+          bool continued = options.continuation && previous.has_value();
+          TwoSampleProcess<Generator> two_choice_with_noice = continued
+            ? previous->clone(decider_producer(param))
+            : TwoSampleProcess<Generator>(n, decider_producer(param));
+          if (continued) {
+            BurnInResult result = burn_in(two_choice_with_noice, generator, std::max<uint64_t>(1, n / 4), m);
+            out << "Re-equilibration : " << result.rounds << " balls\n";
+            mixing_sum = result.mixing_rounds;
+            mixing_runs = 1;
+          } else {
+            mixing_sum = warm_up_trajectory(two_choice_with_noice, generator, n, m, options, checkpoint_path<Generator>(options, name, n, param, m, seed)).mixing_rounds;
+            mixing_runs = 1;
+          }
+          auto save_snapshot = [&](size_t sample, const TwoSampleProcess<Generator>& process) {
+            if (options.snapshot_dir.empty()) return;
+            process.saveSnapshot(options.snapshot_dir + "/" + name + "_n" + std::to_string(n) + "_" + std::to_string(param)
+              + "_" + std::to_string(sample) + ".snap");
+          };
+          // The first sample is taken at the end of the warm-up, so by default
+          // the gap is sampled after m, 2m, ... balls as in the paper.
+          auto add_sample = [&](size_t sample, const TwoSampleProcess<Generator>& process) {
+            int current_gap = process.getGap();
+            // A re-simulated trajectory may already be (partially) journaled.
+            if (options.journal != nullptr && options.journal->find(name, param, n, m + sample * interval, sample, seed, variant) == nullptr) {
+              options.journal->append({ name, param, uint64_t(n), m + sample * interval, sample, seed, current_gap, variant });
+            }
+            gaps.push_back(current_gap);
+            save_snapshot(sample, process);
+          };
+          if (options.samples > 0) {
+            add_sample(0, two_choice_with_noice);
+            sample_stationary(two_choice_with_noice, generator, 0, interval, options.samples - 1,
+                              [&](size_t sample, const TwoSampleProcess<Generator>& process) { add_sample(sample + 1, process); });
+          }
+          if (options.continuation) {
+            if (!final_path.empty()) {
+              two_choice_with_noice.saveCheckpoint(final_path, generator);
+            }
+            previous.emplace(std::move(two_choice_with_noice));
+          }
+        }
+        for (auto gap : gaps) {
+          statistics.add(gap);
+        }
+      } else {
+        horizons = horizons_in_balls(options.horizons, m_batches, n);
+        bool detect_burn_in = options.detect_burn_in && horizons.size() == 1;
+        RunStore store(options.journal, options.cache);
+        // The process of the previous simulated run, which is reset and reused.
+        std::optional<TwoSampleProcess<Generator>> pooled;
+        std::vector<GapStatistics> horizon_statistics(horizons.size());
+        for (uint64_t run = 0; !options.shard.shouldStop(options.stopping, run, horizon_statistics.back()) && !interrupted(); ++run) {
+          uint64_t seed = derive_seed(options.seed, { hash_string(name), uint64_t(param), n, run });
+          if (!options.shard.owns(seed)) continue;
+          std::vector<Measurement> measurements;
+          for (auto horizon : horizons) {
+            measurements.push_back({ name, { "two-sample", name, param, uint64_t(n), horizon, 1, generator_name<Generator>(), options.seed,
+                                             detect_burn_in ? "detect-burn-in" : "" } });
+          }
+          std::vector<int> run_gaps;
+          if (!store.lookup(measurements, run, seed, run_gaps)) {
+            Generator generator(seed);
+            if (pooled.has_value()) {
+              pooled->reset();
+            } else {
+              pooled.emplace(n, decider_producer(param));
+            }
+            TwoSampleProcess<Generator>& two_choice_with_noice = *pooled;
+            if (detect_burn_in) {
+              mixing_sum += warm_up_trajectory(two_choice_with_noice, generator, n, horizons[0], options, "").mixing_rounds;
+              ++mixing_runs;
+              run_gaps.push_back(two_choice_with_noice.getGapFloor());
+            } else {
+              std::unique_ptr<TrajectoryRecorder> recorder;
+              if (run == 0 && !options.trajectory_dir.empty()) {
+                RecorderOptions recorder_options = options.recorder;
+                if (recorder_options.interval == 0) recorder_options.interval = n;
+                recorder = std::make_unique<TrajectoryRecorder>(
+                  options.trajectory_dir + "/" + name + "_n" + std::to_string(n) + "_" + std::to_string(param) + ".traj", n, recorder_options);
+              }
+              if (options.progress != nullptr) {
+                options.progress->start(name + " (n = " + std::to_string(n) + ", run " + std::to_string(run) + ")", horizons.back());
+              }
+              run_to_horizons(two_choice_with_noice, generator, horizons, [&run_gaps](size_t, const TwoSampleProcess<Generator>& process) {
+                run_gaps.push_back(process.getGapFloor());
+              }, recorder.get(), options.progress);
+            }
+          }
+          store.record(measurements, run, seed, run_gaps);
+          for (size_t i = 0; i < horizons.size(); ++i) {
+            horizon_statistics[i].add(run_gaps[i]);
+          }
+        }
+        statistics = horizon_statistics.back();
+        horizon_statistics.pop_back();
+        earlier_horizons = std::move(horizon_statistics);
+      }
+      if (interrupted()) return;
+      if (options.detect_burn_in) {
+        print_mixing_point(mixing_sum, mixing_runs, out);
+      }
+      size_t runs = statistics.getCount();
+      bool sequential = options.mode == SamplingMode::kIndependentRuns && options.stopping.precision > 0.0;
+      if (sequential) {
+        out << "Runs : " << runs << "\n";
+      }
+      coordinate_plot.push_back({ param, statistics.getMean() });
+      for (size_t i = 0; i < earlier_horizons.size(); ++i) {
+        write_gap_distribution(options.results, name, param, n, horizons[i], earlier_horizons[i]);
+      }
+      write_gap_distribution(options.results, name, param, n, horizons.empty() ? m : horizons.back(), statistics);
+      ConfidenceInterval interval = options.mode == SamplingMode::kStationary
+        ? correlated_interval(gaps, options.interval_method)
+        : statistics.getMeanInterval();
+      if (options.mode == SamplingMode::kStationary && !options.print_interval) {
+        print_gap_distribution(statistics, false, out);
+        continue;
+      }
+      std::vector<GapStatistics> all_horizons = earlier_horizons;
+      all_horizons.push_back(statistics);
+      print_noise_entry(horizons, all_horizons, interval, sequential, out);
+      // out << "g : " << g << " gives " <<  << std::endl;
+    }
+  }
+}
+
+/* A sweep of `normal_noise` over the parameter values of a decider. */
+template<typename Generator>
+struct NoiseSweep {
+  /* Heading printed before the sweep, e.g., "Sigma-noise: ". */
+  std::string heading;
+  std::string name;
+  std::function<DeciderFn<Generator>(int)> decider_producer;
+};
+
+/* Returns the sweep of the decider with the given name, with the heading
+   of the paper's experiments. */
+template<typename Generator>
+NoiseSweep<Generator> make_noise_sweep(const std::string& decider) {
+  auto it = std::find_if(kNoiseSweepHeadings.begin(), kNoiseSweepHeadings.end(),
+                         [&decider](const auto& sweep) { return sweep.first == decider; });
+  std::string heading = it == kNoiseSweepHeadings.end() ? decider + ": " : it->second;
+  return { heading, decider, decider_producer<Generator>(decider) };
+}
+
+/* Returns the estimated memory and time of the sweep for n bins. */
+inline JobEstimate estimate_noise_sweep(const CostModel& model, uint64_t n, uint64_t m_batches, size_t num_params, const SamplingOptions& options) {
+  uint64_t m = m_batches * n;
+  uint64_t balls;
+  if (options.mode == SamplingMode::kStationary) {
+    uint64_t interval = options.sample_interval == 0 ? m : options.sample_interval;
+    balls = m + std::max(options.samples - 1, 0) * interval;
+  } else {
+    balls = options.stopping.max_runs * horizons_in_balls(options.horizons, m_batches, n).back();
+  }
+  JobEstimate estimate = model.estimateTwoSample(n, num_params * balls);
+  // The final state of the previous parameter value is kept for the continuation.
+  if (options.continuation) estimate.memory_bytes *= 2;
+  return estimate;
+}
+
+/* Runs the sweeps with one job per sweep and number of bins, scheduled on
+   `threads` threads within `memory_budget` bytes, and prints their output
+   in the same order as running them one after the other. */
+template<typename Generator>
+void scheduled_noise(
+  const std::vector<NoiseSweep<Generator>>& sweeps,
+  uint64_t m_batches,
+  const std::vector<int>& param_values,
+  const SamplingOptions& options,
+  size_t threads,
+  uint64_t memory_budget) {
+  CostModel model;
+  SweepScheduler scheduler(threads, memory_budget);
+  std::vector<uint64_t> bins = bin_counts(options);
+  std::vector<std::ostringstream> outputs(sweeps.size() * bins.size());
+  for (size_t i = 0; i < sweeps.size(); ++i) {
+    for (size_t j = 0; j < bins.size(); ++j) {
+      SamplingOptions job_options = options;
+      job_options.bins = { (long long) bins[j] };
+      job_options.out = &outputs[i * bins.size() + j];
+      // Progress reports of concurrent runs would interleave.
+      job_options.progress = nullptr;
+      const NoiseSweep<Generator>& sweep = sweeps[i];
+      scheduler.add({ sweep.name + " (n = " + std::to_string(bins[j]) + ")",
+                      estimate_noise_sweep(model, bins[j], m_batches, param_values.size(), options),
+                      [=, &sweep]() {
+                        normal_noise<Generator>(sweep.name, m_batches, param_values, sweep.decider_producer, job_options);
+                      } });
+    }
+  }
+  print_schedule_plan(scheduler, std::cerr);
+  scheduler.run();
+  for (size_t i = 0; i < sweeps.size(); ++i) {
+    *options.out << sweeps[i].heading << "\n";
+    for (size_t j = 0; j < bins.size(); ++j) {
+      *options.out << outputs[i * bins.size() + j].str();
+    }
+  }
+}
+
+/* Runs the sweeps one after the other, or scheduled on `threads` threads
+   within `memory_budget` bytes if there are several threads. */
+template<typename Generator>
+void run_noise_sweeps(
+  const std::vector<NoiseSweep<Generator>>& sweeps,
+  uint64_t m_batches,
+  const std::vector<int>& param_values,
+  const SamplingOptions& options,
+  size_t threads,
+  uint64_t memory_budget) {
+  if (threads > 1) {
+    scheduled_noise<Generator>(sweeps, m_batches, param_values, options, threads, memory_budget);
+    return;
+  }
+  for (const auto& sweep : sweeps) {
+    if (interrupted()) return;
+    *options.out << sweep.heading << "\n";
+    normal_noise<Generator>(sweep.name, m_batches, param_values, sweep.decider_producer, options);
+  }
+}
+
+#endif  // NOISE22_NOISE_EXPERIMENTS_H_
@@ -3,153 +3,118 @@
       by Dimitrios Los and Thomas Sauerwald (PODC'22)
       [https://arxiv.org/abs/2302.04399]. */
 #include <algorithm>
+#include <filesystem>
 #include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <optional>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 
-template<typename Generator>
-using DeciderFn = std::function<size_t(const std::vector<size_t>&, size_t, size_t, Generator)>;
-
-/* A process that makes two samples in each round and allocates 
-   according to a decision function to one of the two. */
-template<typename Generator>
-class TwoSampleProcess {
-public:
-
-  /* Iniitializes the Two-Sample process. */
-  TwoSampleProcess(
-    size_t num_bins, 
-    const DeciderFn<Generator> decider)
-    : load_vector_(num_bins, 0), max_load_(0), total_balls_(0), uar_(0, num_bins - 1), decider_(decider) {
-
-  }
-
-  /* Performs an allocation of a batch. */
-  void nextRound(Generator& generator) {
-    size_t n = load_vector_.size();
-    size_t i1 = uar_(generator);
-    size_t i2 = uar_(generator);
-    size_t idx = decider_(load_vector_, i1, i2, generator);
-    ++load_vector_[idx];
-    ++total_balls_;
-    max_load_ = std::max(max_load_, load_vector_[idx]);
-  }
-
-  /* Returns the current maximum load. */
-  size_t getMaxLoad() const {
-    return max_load_;
-  }
-
-  /* Returns the current gap. */
-  double getGap() const {
-    return max_load_ - total_balls_ / double(load_vector_.size());
-  }
-
-  /* Returns the current load vector. */
-  std::vector<size_t> getLoadVector() const {
-    return load_vector_;
-  }
-
-private:
-
-  /* Functon that decides in which of the two sampled bins to allocate to. */
-  const DeciderFn<Generator> decider_;
-
-  /* Current load vector of the process. */
-  std::vector<size_t> load_vector_;
-
-  /* Sample a bin uniformly at random. */
-  std::uniform_int<size_t> uar_;
-
-  /* Current maximum load in the load vector. */
-  size_t max_load_;
-
-  /* Total number of balls in the load vector. */
-  size_t total_balls_;
-};
-
-
-template<typename Generator>
-size_t two_choice(const std::vector<size_t>& load_vector, size_t i1, size_t i2, Generator& generator) {
-  if (load_vector[i1] <= load_vector[i2]) return i1;
-  return i2;
-}
-
-template<typename Generator>
-DeciderFn<Generator> g_bounded(int g) {
-  return [g](const std::vector<size_t>& load_vector, size_t i1, size_t i2, Generator& generator) {
-    // Do normal Two-Choice.
-    if (std::llabs(long long(load_vector[i1]) - long long(load_vector[i2])) > g) {
-      if (load_vector[i1] <= load_vector[i2]) return i1;
-      return i2;
-    }
-    // Reverse the allocation.
-    if (load_vector[i1] <= load_vector[i2]) return i2;
-    return i1;
-  };
-}
-
-template<typename Generator>
-DeciderFn<Generator> g_myopic(int g) {
-  return [g](const std::vector<size_t>& load_vector, size_t i1, size_t i2, Generator& generator) {
-    // If the difference is small, then randomise the allocation.
-    if (std::llabs(long long(load_vector[i1]) - long long(load_vector[i2])) <= g) {
-      std::bernoulli_distribution randomiser(0.5);
-      return randomiser(generator) ? i1 : i2;
-    }
-    // Do normal Two-Choice.
-    if (load_vector[i1] <= load_vector[i2]) return i1;
-    return i2;
-  };
-}
+#include "checkpoint.h"
+#include "deciders.h"
+#include "flags.h"
+#include "horizons.h"
+#include "journal.h"
+#include "latex.h"
+#include "load_store.h"
+#include "load_view.h"
+#include "noise_experiments.h"
+#include "progress.h"
+#include "result_cache.h"
+#include "result_sink.h"
+#include "run_store.h"
+#include "scheduler.h"
+#include "seeding.h"
+#include "sharding.h"
+#include "snapshot.h"
+#include "splitting.h"
+#include "stationary.h"
+#include "statistics.h"
+#include "trace.h"
+#include "trajectory.h"
+#include "two_sample_process.h"
 
+/* Estimates, for each configuration, the probability that the gap is at
+   least `target_gap` after n more balls from a stationary state, using
+   multilevel splitting on the gap with one level for each integer value.
+   The estimate is averaged over `starts` stationary states, m balls apart
+   on the warm-up trajectory (with one start, it is conditional on the state
+   after the warm-up). With `naive_runs` > 0, a naive Monte Carlo estimate
+   from the same states is printed as well, for checking. */
 template<typename Generator>
-DeciderFn<Generator> sigma_noisy(int sigma) {
-  return [sigma](const std::vector<size_t>& load_vector, size_t i1, size_t i2, Generator& generator) {
-    std::normal_distribution<double> noise_distribution(0.0, sigma);
-    long long load_estimate_1 = load_vector[i1] + noise_distribution(generator);
-    long long load_estimate_2 = load_vector[i2] + noise_distribution(generator);
-    if (load_estimate_1 <= load_estimate_2) return i1;
-    return i2;
-  };
-}
-
-template<typename Generator>
-void normal_noise(
-  int m_batches, 
-  const std::vector<int>& param_values, 
-  std::function<DeciderFn<Generator>(int)> decider_producer) {
-  Generator generator;
+void noise_tail_probabilities(
+  const std::string& name,
+  uint64_t m_batches,
+  const std::vector<int>& param_values,
+  std::function<DeciderFn<Generator>(int)> decider_producer,
+  int target_gap,
+  const SamplingOptions& options,
+  size_t trajectories_per_level,
+  size_t starts,
+  size_t naive_runs) {
+  Generator generator(options.seed);
 
-  int runs = 100;
-  std::vector<int> ns({ 10'000, 50'000, 100'000 });
-  for (auto n : ns) {
-    std::vector<std::pair<int, int>> coordinate_plot;
-    std::cout << "n : " << n << std::endl << std::endl;
+  for (auto n : bin_counts(options)) {
+    std::cout << "n : " << n << "\n\n";
     for (const auto param : param_values) {
-      std::cout << "Value : " << param << std::endl;
+      std::cout << "Value : " << param << "\n";
+      uint64_t m = m_batches * n;
       TwoSampleProcess<Generator> two_choice_with_noice(n, decider_producer(param));
-      int m = m_batches * n;
-      double sum = 0.0;
-      std::map<int, int> max_load_counts;
-      for (int run = 0; run < runs; ++run) {
-        for (int j = 0; j < m; ++j) {
-          two_choice_with_noice.nextRound(generator);
+      warm_up_trajectory(two_choice_with_noice, generator, n, m, options, checkpoint_path<Generator>(options, name, n, param, m, options.seed));
+      SplittingOptions splitting;
+      for (int level = int(two_choice_with_noice.getGapFloor()) + 1; level <= target_gap; ++level) {
+        splitting.levels.push_back(level);
+      }
+      if (splitting.levels.empty()) {
+        splitting.levels.push_back(target_gap);
+      }
+      splitting.trajectories_per_level = trajectories_per_level;
+      splitting.horizon = n;
+      splitting.measure_at_horizon = true;
+      auto score = [](const TwoSampleProcess<Generator>& process) { return process.getGap(); };
+      std::vector<SplittingResult> estimates, naive_estimates;
+      for (size_t start = 0; start < starts; ++start) {
+        if (start > 0) run_with_progress(two_choice_with_noice, generator, m, nullptr);
+        estimates.push_back(estimate_exceedance(two_choice_with_noice, generator, splitting, score));
+        if (naive_runs > 0) {
+          naive_estimates.push_back(estimate_exceedance_naively(two_choice_with_noice, generator, splitting, score, naive_runs));
         }
-        int current_gap = two_choice_with_noice.getGap();
-        sum += current_gap;
-        max_load_counts[current_gap]++;
       }
-      coordinate_plot.push_back({ param, sum / runs });
-      for (const auto [load, load_count] : max_load_counts) {
-        std::cout << "\\textbf{" << load << "} : " << (load_count * 100 / runs) << "\\%" << std::endl;
+      std::string event = "gap >= " + std::to_string(target_gap) + (starts == 1 ? " | warm-up state" : "");
+      SplittingResult result = average_estimates(estimates);
+      std::cout << "P(" << event << ") : " << result.probability
+                << " (relative error " << result.relative_error << ", " << result.rounds << " balls)\n";
+      if (naive_runs > 0) {
+        SplittingResult naive = average_estimates(naive_estimates);
+        std::cout << "Naive P(" << event << ") : " << naive.probability
+                  << " (relative error " << naive.relative_error << ", " << naive.rounds << " balls)\n";
       }
-      // std::cout << "g : " << g << " gives " <<  << std::endl;
     }
   }
 }
 
+/* Replays the trace with the decider for each of the parameter values (in
+   parallel) and prints the final gaps. */
+template<typename Generator>
+void replay_deciders(
+  const TraceReader& trace,
+  const std::vector<int>& param_values,
+  std::function<DeciderFn<Generator>(int)> decider_producer) {
+  std::vector<TwoSampleProcess<Generator>> processes;
+  processes.reserve(param_values.size());
+  for (const auto param : param_values) {
+    processes.emplace_back(trace.getHeader().num_bins, decider_producer(param));
+  }
+  replay_in_parallel<Generator>(processes, trace);
+  for (size_t i = 0; i < param_values.size(); ++i) {
+    std::cout << "Value : " << param_values[i] << "\n";
+    std::cout << "Gap : " << processes[i].getGap() << "\n";
+  }
+}
+
 std::vector<int> generate_range(int st, int en) {
   std::vector<int> ans;
   for (int i = st; i <= en; ++i) {
@@ -158,12 +123,157 @@ std::vector<int> generate_range(int st, int en) {
   return ans;
 }
 
-int main() {
-  std::cout << "Sigma-noise: " << std::endl;
-  normal_noise<std::mt19937_64>(1'000, generate_range(1, 20), sigma_noisy<std::mt19937_64>);
-  std::cout << "g-Bounded: " << std::endl;
-  normal_noise<std::mt19937_64>(1'000, generate_range(1, 20), g_bounded<std::mt19937_64>);
-  std::cout << "g-Myopic: " << std::endl;
-  normal_noise<std::mt19937_64>(1'000, generate_range(1, 20), g_myopic<std::mt19937_64>);
+int main(int argc, char** argv) {
+  /* Flags selecting how the samples are collected:
+       --mode=independent|stationary  (default: stationary)
+       --samples=<samples per configuration>  (default: 100)
+       --interval=<balls between samples in stationary mode>  (default: m)
+       --ci=batch-means|autocorrelation  (default: batch-means)
+     where the stationary mode only prints the mean gap and its interval
+     with --interval or --ci.
+       --detect-burn-in  (end the burn-in once the trajectory has mixed)
+       --continuation  (start each parameter from the previous final state)
+       --checkpoint-dir=<directory>  (resume/warm-start single trajectories)
+       --checkpoint-interval=<balls between checkpoints during the warm-up>
+       --seed=<base seed of the runs>  (default: 0)
+       --journal=<file>  (resume an interrupted sweep from its journal)
+       --cache=<directory>  (reuse the independent runs of earlier sweeps)
+       --results=<file.csv|file.jsonl|file>  (append the distributions)
+       --snapshot-dir=<directory>  (save the load vector at every stationary sample)
+       --bins=<n1>,<n2>,...  (default: 10000,50000,100000)
+       --pages=default|transparent|2m|1g  (huge pages for the load vectors)
+       --store-dir=<directory>  (keep the load vectors in files there, for n beyond the memory)
+       --progress  (report the progress of long runs to stderr)
+       --progress-period=<seconds between reports>  (default: 10)
+       --threads=<threads>  (run the sweeps for different n in parallel)
+       --memory-budget=<GB for the load vectors of the parallel runs>  (default: 4)
+       --placement=none|compact|scatter|per-socket  (pin the parallel threads to NUMA nodes)
+     and, in the independent runs mode, the number of runs and their measurements:
+       --precision=<target half-width of the interval of each gap entry>
+       --min-runs=<runs>, --max-runs=<runs>  (default: --samples)
+       --horizons=<h1>,<h2>,...  (measure after h1 n, h2 n, ... balls in each run)
+       --record-dir=<directory>  (record the trajectory of the first run)
+       --record-interval=<balls between samples>  (default: n)
+       --record-growth=<factor>  (sample at logarithmically spaced points)
+       --record-levels=<number of levels below the maximum to count>
+       --shard=<k>/<K>  (only compute the runs of shard k of K, see sharding.h)
+     A trace of uniformly sampled bins can be written and then replayed with
+     every decider:
+       --write-trace=<file> --trace-bins=<n> --trace-balls=<m>
+       --replay=<file>
+     Instead of the gap distributions, the tail probabilities P(gap >= k)
+     can be estimated with multilevel splitting:
+       --tail-gap=<k> --trajectories=<trajectories per level>  (default: 1000)
+       --starts=<stationary starting states, m balls apart>  (default: 1)
+       --naive-runs=<runs>  (also print a naive Monte Carlo estimate) */
+  Flags flags(argc, argv);
+  SamplingOptions options;
+  if (flags.getString("mode", "stationary") == "independent") {
+    options.mode = SamplingMode::kIndependentRuns;
+  }
+  options.samples = flags.getInt("samples", options.samples);
+  options.sample_interval = flags.getInt("interval", 0);
+  if (flags.getString("ci", "batch-means") == "autocorrelation") {
+    options.interval_method = IntervalMethod::kAutocorrelation;
+  }
+  options.print_interval = flags.has("interval") || flags.has("ci");
+  options.detect_burn_in = flags.has("detect-burn-in");
+  options.continuation = flags.has("continuation");
+  options.checkpoint_dir = flags.getString("checkpoint-dir", "");
+  options.checkpoint_interval = flags.getInt("checkpoint-interval", 0);
+  options.seed = flags.getInt("seed", 0);
+  options.horizons = flags.getIntList("horizons");
+  default_page_mode() = parse_page_mode(flags.getString("pages", "default"));
+  thread_placement() = parse_placement_policy(flags.getString("placement", "none"));
+  if (flags.has("store-dir")) {
+    store_directory() = flags.getString("store-dir", ".");
+    default_page_mode() = PageMode::kFile;
+  }
+  options.bins = flags.getIntList("bins");
+  std::unique_ptr<ProgressReporter> progress;
+  if (flags.has("progress")) {
+    progress = std::make_unique<ProgressReporter>(flags.getDouble("progress-period", 10.0), flags.has("store-dir"));
+    options.progress = progress.get();
+  }
+  options.snapshot_dir = flags.getString("snapshot-dir", "");
+  if (!options.snapshot_dir.empty()) {
+    std::filesystem::create_directories(options.snapshot_dir);
+  }
+  options.trajectory_dir = flags.getString("record-dir", "");
+  options.recorder.interval = flags.getInt("record-interval", 0);
+  if (flags.has("record-growth")) {
+    options.recorder.schedule = RecordSchedule::kLogarithmic;
+    options.recorder.growth = flags.getDouble("record-growth", 1.1);
+  }
+  options.recorder.levels = flags.getInt("record-levels", 0);
+  if (!options.trajectory_dir.empty()) {
+    std::filesystem::create_directories(options.trajectory_dir);
+  }
+  std::unique_ptr<Journal> journal;
+  if (flags.has("journal")) {
+    journal = std::make_unique<Journal>(flags.getString("journal", ""));
+    options.journal = journal.get();
+    install_interrupt_handlers();
+  }
+  std::unique_ptr<ResultSink> results;
+  if (flags.has("results")) {
+    results = make_result_sink(flags.getString("results", ""));
+    options.results = results.get();
+  }
+  std::unique_ptr<ResultCache> cache;
+  if (flags.has("cache")) {
+    cache = std::make_unique<ResultCache>(flags.getString("cache", ""));
+    options.cache = cache.get();
+  }
+  options.stopping.precision = flags.getDouble("precision", 0.0);
+  options.stopping.min_runs = flags.getInt("min-runs", options.samples);
+  options.stopping.max_runs = flags.getInt("max-runs", options.samples);
+  if (flags.has("shard")) {
+    options.shard = parse_shard(flags.getString("shard", "0/1"));
+    if (options.mode != SamplingMode::kIndependentRuns || options.stopping.precision > 0.0) {
+      throw std::runtime_error("--shard needs --mode=independent and a fixed number of runs");
+    }
+  }
+
+  if (flags.has("write-trace")) {
+    generate_trace<std::mt19937_64>(flags.getString("write-trace", ""), flags.getInt("trace-bins", 10'000),
+                                    flags.getInt("trace-balls", 10'000'000), options.seed);
+    return 0;
+  }
+  if (flags.has("replay")) {
+    TraceReader trace(flags.getString("replay", ""));
+    std::cout << "Sigma-noise: \n";
+    replay_deciders<std::mt19937_64>(trace, generate_range(1, 20), sigma_noisy<std::mt19937_64>);
+    std::cout << "g-Bounded: \n";
+    replay_deciders<std::mt19937_64>(trace, generate_range(1, 20), g_bounded<std::mt19937_64>);
+    std::cout << "g-Myopic: \n";
+    replay_deciders<std::mt19937_64>(trace, generate_range(1, 20), g_myopic<std::mt19937_64>);
+    return 0;
+  }
+
+  if (flags.has("tail-gap")) {
+    int target_gap = flags.getInt("tail-gap", 0);
+    size_t trajectories = flags.getInt("trajectories", 1'000);
+    size_t starts = flags.getInt("starts", 1);
+    size_t naive_runs = flags.getInt("naive-runs", 0);
+    std::cout << "Sigma-noise: \n";
+    noise_tail_probabilities<std::mt19937_64>("sigma-noisy", 1'000, generate_range(1, 20), sigma_noisy<std::mt19937_64>, target_gap, options, trajectories, starts, naive_runs);
+    std::cout << "g-Bounded: \n";
+    noise_tail_probabilities<std::mt19937_64>("g-bounded", 1'000, generate_range(1, 20), g_bounded<std::mt19937_64>, target_gap, options, trajectories, starts, naive_runs);
+    std::cout << "g-Myopic: \n";
+    noise_tail_probabilities<std::mt19937_64>("g-myopic", 1'000, generate_range(1, 20), g_myopic<std::mt19937_64>, target_gap, options, trajectories, starts, naive_runs);
+    return 0;
+  }
+
+  std::vector<NoiseSweep<std::mt19937_64>> sweeps;
+  for (const auto& [decider, heading] : kNoiseSweepHeadings) {
+    sweeps.push_back(make_noise_sweep<std::mt19937_64>(decider));
+  }
+  uint64_t memory_budget = uint64_t(flags.getDouble("memory-budget", 4.0) * (uint64_t(1) << 30));
+  run_noise_sweeps<std::mt19937_64>(sweeps, 1'000, generate_range(1, 20), options, flags.getInt("threads", 1), memory_budget);
+  if (interrupted()) {
+    std::cerr << "Interrupted with " << journal->size() << " runs in the journal." << std::endl;
+    return 1;
+  }
   return 0;
 }
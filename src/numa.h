@@ -0,0 +1,250 @@
+/* Placement of the worker threads (and of the load vectors they allocate)
+   on the NUMA nodes of the host.
+
+   For large n, every ball is a random access to the load vector, so a
+   replica whose pages live on a remote node runs much slower than one on
+   the node of its thread. The parallel runners therefore pin each worker
+   thread according to a `PlacementPolicy`:
+     - `kCompact` fills the CPUs of the first node before using the next,
+     - `kScatter` deals the threads to the nodes round-robin, one CPU each,
+     - `kPerSocket` splits the threads evenly between the nodes, each
+       thread being allowed on all CPUs of its node,
+   and records the node of the thread as its preferred node. The load
+   stores allocated by a pinned thread are then bound to that node (with
+   `mbind(MPOL_PREFERRED)`, which falls back to other nodes when it is
+   full), and the ones from `calloc` are placed there by the kernel's
+   first-touch policy, since their pages are only backed when first
+   written (by the thread running the replica). The file-backed stores
+   (`PageMode::kFile`) are bound in the same way, which the kernel honours
+   for stores on tmpfs. For other filesystems, the page cache ignores the
+   binding and places each page on the node of the thread that first touches
+   it (again the worker's node). A page that is evicted and read back later
+   may then land on another node, so such stores are only local on a
+   best-effort basis.
+
+   The topology is read from /sys/devices/system/node, so no library is
+   needed; on other systems (or with `kNone`) the threads are not pinned. */
+#ifndef NOISE22_NUMA_H_
+#define NOISE22_NUMA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define NOISE22_HAS_NUMA 1
+#endif
+
+enum class PlacementPolicy {
+  kNone,
+  kCompact,
+  kScatter,
+  kPerSocket
+};
+
+/* Returns the placement of the worker threads of the parallel runners. */
+inline PlacementPolicy& thread_placement() {
+  static PlacementPolicy policy = PlacementPolicy::kNone;
+  return policy;
+}
+
+/* Parses "none", "compact", "scatter" or "per-socket". */
+inline PlacementPolicy parse_placement_policy(const std::string& name) {
+  if (name == "none") return PlacementPolicy::kNone;
+  if (name == "compact") return PlacementPolicy::kCompact;
+  if (name == "scatter") return PlacementPolicy::kScatter;
+  if (name == "per-socket") return PlacementPolicy::kPerSocket;
+  throw std::runtime_error("Unknown placement policy " + name);
+}
+
+/* Returns the node the load stores of the current thread are bound to, or
+   -1 for no binding. */
+inline int& preferred_numa_node() {
+  thread_local int node = -1;
+  return node;
+}
+
+/* The CPUs (available to this process) of each NUMA node. */
+class NumaTopology {
+public:
+
+  /* Reads the topology of the host, which is a single node with all CPUs
+     if it is not available. */
+  static NumaTopology detect() {
+    NumaTopology topology;
+#ifdef NOISE22_HAS_NUMA
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    for (int node = 0;; ++node) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!in) break;
+      std::string list;
+      std::getline(in, list);
+      std::vector<int> cpus;
+      for (int cpu : parseCpuList(list)) {
+        if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) cpus.push_back(cpu);
+      }
+      topology.nodes_.push_back(cpus);
+      topology.node_ids_.push_back(node);
+    }
+    // Nodes without (available) CPUs only hold memory.
+    for (size_t i = topology.nodes_.size(); i-- > 0;) {
+      if (topology.nodes_[i].empty()) {
+        topology.nodes_.erase(topology.nodes_.begin() + i);
+        topology.node_ids_.erase(topology.node_ids_.begin() + i);
+      }
+    }
+    if (topology.nodes_.empty() && restricted) {
+      std::vector<int> cpus;
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+      }
+      topology.nodes_.push_back(cpus);
+      topology.node_ids_.push_back(0);
+    }
+#endif
+    if (topology.nodes_.empty()) {
+      std::vector<int> cpus;
+      for (int cpu = 0; cpu < int(std::max(1u, std::thread::hardware_concurrency())); ++cpu) {
+        cpus.push_back(cpu);
+      }
+      topology.nodes_.push_back(cpus);
+      topology.node_ids_.push_back(0);
+    }
+    return topology;
+  }
+
+  /* Parses a list of CPUs such as "0-3,8-11". */
+  static std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+      if (range.empty()) continue;
+      size_t dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+
+  size_t getNumNodes() const {
+    return nodes_.size();
+  }
+
+  /* Returns the id of the i-th node (ids may have holes). */
+  int getNodeId(size_t i) const {
+    return node_ids_[i];
+  }
+
+  const std::vector<int>& getCpus(size_t i) const {
+    return nodes_[i];
+  }
+
+  size_t getNumCpus() const {
+    size_t cpus = 0;
+    for (const auto& node : nodes_) {
+      cpus += node.size();
+    }
+    return cpus;
+  }
+
+private:
+
+  std::vector<std::vector<int>> nodes_;
+  std::vector<int> node_ids_;
+};
+
+/* Node and CPUs a worker thread is pinned to. */
+struct ThreadPlacement {
+  int node;
+  std::vector<int> cpus;
+};
+
+/* Returns the placement of the `thread`-th of `num_threads` workers. When
+   there are more threads than CPUs, the CPUs are reused in the same
+   order. */
+inline ThreadPlacement place_thread(const NumaTopology& topology, PlacementPolicy policy, size_t thread, size_t num_threads) {
+  size_t nodes = topology.getNumNodes();
+  switch (policy) {
+    case PlacementPolicy::kCompact: {
+      size_t index = thread % topology.getNumCpus();
+      for (size_t i = 0;; ++i) {
+        if (index < topology.getCpus(i).size()) return { topology.getNodeId(i), { topology.getCpus(i)[index] } };
+        index -= topology.getCpus(i).size();
+      }
+    }
+    case PlacementPolicy::kScatter: {
+      size_t i = thread % nodes;
+      const std::vector<int>& cpus = topology.getCpus(i);
+      return { topology.getNodeId(i), { cpus[(thread / nodes) % cpus.size()] } };
+    }
+    case PlacementPolicy::kPerSocket: {
+      size_t i = std::min(nodes - 1, thread * nodes / std::max<size_t>(num_threads, 1));
+      return { topology.getNodeId(i), topology.getCpus(i) };
+    }
+    default:
+      return { -1, {} };
+  }
+}
+
+namespace internal {
+
+/* Memory policy of `mbind`, from <numaif.h>. */
+constexpr int kPreferredMemoryPolicy = 1;
+
+}  // namespace internal
+
+/* Pins the current thread as given by the placement and makes its node
+   the preferred node of its load stores, returning false if this is not
+   supported. */
+inline bool pin_current_thread(const ThreadPlacement& placement) {
+  if (placement.node < 0) return false;
+#ifdef NOISE22_HAS_NUMA
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int cpu : placement.cpus) {
+    CPU_SET(cpu, &cpus);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) return false;
+  preferred_numa_node() = placement.node;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Pins the `thread`-th of `num_threads` workers with the given policy. */
+inline bool pin_worker_thread(PlacementPolicy policy, size_t thread, size_t num_threads) {
+  if (policy == PlacementPolicy::kNone) return false;
+  static const NumaTopology topology = NumaTopology::detect();
+  return pin_current_thread(place_thread(topology, policy, thread, num_threads));
+}
+
+/* Asks the kernel to back the (page-aligned) range with memory of the
+   given node where possible. Failures are ignored, as the placement only
+   affects performance. */
+inline void bind_to_numa_node(void* data, size_t bytes, int node) {
+#if defined(NOISE22_HAS_NUMA) && defined(SYS_mbind)
+  if (node < 0) return;
+  constexpr size_t kMaskBits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / kMaskBits + 1, 0);
+  mask[node / kMaskBits] |= 1ul << (node % kMaskBits);
+  syscall(SYS_mbind, data, bytes, internal::kPreferredMemoryPolicy, mask.data(), mask.size() * kMaskBits + 1, 0);
+#endif
+}
+
+#endif  // NOISE22_NUMA_H_
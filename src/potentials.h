@@ -0,0 +1,195 @@
+/* Incremental tracking of the potential functions used in the analysis. */
+#ifndef NOISE22_POTENTIALS_H_
+#define NOISE22_POTENTIALS_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "level_histogram.h"
+#include "load_view.h"
+
+/* Observer that maintains, for the normalized loads y_i - t/n,
+     - the overload potential Phi = sum_i exp(alpha * (y_i - t/n)),
+     - the underload potential Psi = sum_i exp(-alpha * (y_i - t/n)),
+     - the quadratic potential Upsilon = sum_i (y_i - t/n)^2, and
+     - the absolute potential Delta = sum_i |y_i - t/n|,
+   in O(1) time per ball (instead of an O(n) pass over the load vector), so
+   they can be sampled after every ball.
+
+   All sums are kept relative to the integer part r of the average load t/n
+   and are re-centered (in O(1) time) whenever it increases:
+     - the quadratic potential from the exact integer sums of y_i - r and
+       (y_i - r)^2,
+     - the absolute potential from the number of bins with load above r and
+       the sum of their y_i - r, since Delta = 2 * sum_{y_i > t/n} (y_i - t/n),
+     - the exponential potentials from sums of exp(+-alpha * (y_i - r)),
+       with the exponentials looked up in a precomputed table.
+   The exponential sums accumulate rounding errors, so every n balls they
+   are recomputed from the level histogram in O(max - min) time. */
+class PotentialTracker : public NoObserver {
+public:
+
+  PotentialTracker(size_t num_bins, double alpha)
+    : num_bins_(num_bins), alpha_(alpha), histogram_(num_bins), total_balls_(0), reference_(0),
+      sum_offsets_(0), sum_squared_offsets_(0), bins_above_(0), sum_above_(0),
+      overload_sum_(double(num_bins)), underload_sum_(double(num_bins)), balls_since_renormalization_(0),
+      exp_table_(2 * kTableRadius + 1) {
+    for (int64_t offset = -kTableRadius; offset <= kTableRadius; ++offset) {
+      exp_table_[offset + kTableRadius] = std::exp(alpha * offset);
+    }
+  }
+
+  void onAllocation(size_t bin, size_t old_load, size_t new_load) {
+    histogram_.onAllocation(bin, old_load, new_load);
+    int64_t old_offset = int64_t(old_load - reference_);
+    int64_t new_offset = int64_t(new_load - reference_);
+    sum_offsets_ += new_offset - old_offset;
+    sum_squared_offsets_ += new_offset * new_offset - old_offset * old_offset;
+    if (old_offset > 0) {
+      --bins_above_;
+      sum_above_ -= old_offset;
+    }
+    if (new_offset > 0) {
+      ++bins_above_;
+      sum_above_ += new_offset;
+    }
+    overload_sum_ += exponential(new_offset) - exponential(old_offset);
+    underload_sum_ += exponential(-new_offset) - exponential(-old_offset);
+
+    total_balls_ += new_load - old_load;
+    while (total_balls_ / num_bins_ > reference_) {
+      recenter();
+    }
+    balls_since_renormalization_ += new_load - old_load;
+    if (balls_since_renormalization_ >= num_bins_) {
+      renormalize();
+    }
+  }
+
+  /* Recomputes all potentials from the loads in O(n) time. */
+  void onRestore(LoadView loads) {
+    histogram_.onRestore(loads);
+    total_balls_ = 0;
+    for (auto load : loads) {
+      total_balls_ += load;
+    }
+    reference_ = total_balls_ / num_bins_;
+    sum_offsets_ = 0;
+    sum_squared_offsets_ = 0;
+    bins_above_ = 0;
+    sum_above_ = 0;
+    for (auto load : loads) {
+      int64_t offset = int64_t(load - reference_);
+      sum_offsets_ += offset;
+      sum_squared_offsets_ += offset * offset;
+      if (offset > 0) {
+        ++bins_above_;
+        sum_above_ += offset;
+      }
+    }
+    renormalize();
+  }
+
+  /* Returns Phi = sum_i exp(alpha * (y_i - t/n)). */
+  double getOverloadPotential() const {
+    return overload_sum_ * std::exp(-alpha_ * getFraction());
+  }
+
+  /* Returns Psi = sum_i exp(-alpha * (y_i - t/n)). */
+  double getUnderloadPotential() const {
+    return underload_sum_ * std::exp(alpha_ * getFraction());
+  }
+
+  /* Returns Gamma = Phi + Psi. */
+  double getHyperbolicCosinePotential() const {
+    return getOverloadPotential() + getUnderloadPotential();
+  }
+
+  /* Returns Upsilon = sum_i (y_i - t/n)^2. */
+  double getQuadraticPotential() const {
+    return sum_squared_offsets_ - double(sum_offsets_) * double(sum_offsets_) / num_bins_;
+  }
+
+  /* Returns Delta = sum_i |y_i - t/n|. */
+  double getAbsolutePotential() const {
+    return 2 * (sum_above_ - bins_above_ * getFraction());
+  }
+
+  double getAlpha() const {
+    return alpha_;
+  }
+
+  /* Returns the histogram of the load levels, which is maintained anyway. */
+  const LevelHistogram& getHistogram() const {
+    return histogram_;
+  }
+
+private:
+
+  /* Offsets y_i - r within this radius use the table of exponentials. */
+  static constexpr int64_t kTableRadius = 64;
+
+  /* Returns exp(alpha * offset). */
+  double exponential(int64_t offset) const {
+    if (offset < -kTableRadius || offset > kTableRadius) return std::exp(alpha_ * offset);
+    return exp_table_[offset + kTableRadius];
+  }
+
+  /* Returns t/n - r, in [0, 1). */
+  double getFraction() const {
+    return sum_offsets_ / double(num_bins_);
+  }
+
+  /* Moves the reference from r to r + 1. */
+  void recenter() {
+    int64_t bins_at_next = int64_t(histogram_.getBinsAt(reference_ + 1));
+    ++reference_;
+    sum_squared_offsets_ += -2 * sum_offsets_ + int64_t(num_bins_);
+    sum_offsets_ -= int64_t(num_bins_);
+    sum_above_ -= bins_above_;
+    bins_above_ -= bins_at_next;
+    overload_sum_ *= exponential(-1);
+    underload_sum_ *= exponential(1);
+  }
+
+  /* Recomputes the exponential sums from the level histogram. */
+  void renormalize() {
+    overload_sum_ = 0;
+    underload_sum_ = 0;
+    for (size_t load = histogram_.getMinLoad(); load <= histogram_.getMaxLoad(); ++load) {
+      double bins = double(histogram_.getBinsAt(load));
+      if (bins == 0) continue;
+      int64_t offset = int64_t(load - reference_);
+      overload_sum_ += bins * exponential(offset);
+      underload_sum_ += bins * exponential(-offset);
+    }
+    balls_since_renormalization_ = 0;
+  }
+
+  const size_t num_bins_;
+  const double alpha_;
+  LevelHistogram histogram_;
+  uint64_t total_balls_;
+
+  /* The reference r = floor(t/n). */
+  size_t reference_;
+
+  /* Sums of y_i - r and (y_i - r)^2 over all bins. */
+  int64_t sum_offsets_;
+  int64_t sum_squared_offsets_;
+
+  /* Number of bins with y_i > r and the sum of their y_i - r. */
+  int64_t bins_above_;
+  int64_t sum_above_;
+
+  /* Sums of exp(alpha * (y_i - r)) and exp(-alpha * (y_i - r)). */
+  double overload_sum_;
+  double underload_sum_;
+  uint64_t balls_since_renormalization_;
+
+  /* exp(alpha * k) for |k| <= kTableRadius. */
+  std::vector<double> exp_table_;
+};
+
+#endif  // NOISE22_POTENTIALS_H_
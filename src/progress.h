@@ -0,0 +1,105 @@
+/* Progress reports for long runs (e.g., 10^14 balls), which are simulated in
+   chunks so that the clock is only read once per chunk. */
+#ifndef NOISE22_PROGRESS_H_
+#define NOISE22_PROGRESS_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/* Reads the numbers of bytes this process has read from and written to
+   storage (from /proc/self/io), returning false where they are not
+   available. */
+inline bool read_io_counters(uint64_t& read_bytes, uint64_t& written_bytes) {
+  std::ifstream in("/proc/self/io");
+  std::string key;
+  uint64_t value;
+  int found = 0;
+  while (in >> key >> value) {
+    if (key == "read_bytes:") {
+      read_bytes = value;
+      ++found;
+    } else if (key == "write_bytes:") {
+      written_bytes = value;
+      ++found;
+    }
+  }
+  return found == 2;
+}
+
+/* Prints the number of balls simulated, the throughput and the estimated
+   remaining time of a run, at most once every `period` seconds. With
+   `report_io`, it also prints the storage throughput of the process (e.g.,
+   for load vectors in files). */
+class ProgressReporter {
+public:
+
+  explicit ProgressReporter(double period = 10.0, bool report_io = false, std::ostream& out = std::cerr)
+    : period_(period), report_io_(report_io), out_(out) {
+
+  }
+
+  /* Starts reporting on a run that will reach `target_balls` balls. */
+  void start(const std::string& label, uint64_t target_balls) {
+    label_ = label;
+    target_balls_ = target_balls;
+    start_ = std::chrono::steady_clock::now();
+    last_report_ = start_;
+    if (report_io_ && !read_io_counters(start_read_bytes_, start_written_bytes_)) {
+      report_io_ = false;
+    }
+  }
+
+  /* Reports that the run has reached `balls` balls, if the period since the
+     last report has passed. */
+  void update(uint64_t balls) {
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last_report_).count() < period_) return;
+    last_report_ = now;
+    double elapsed = std::chrono::duration<double>(now - start_).count();
+    double throughput = balls / std::max(elapsed, 1e-9);
+    out_ << label_ << " : " << balls << " / " << target_balls_ << " balls ("
+         << 100.0 * balls / std::max<uint64_t>(target_balls_, 1) << "%, " << throughput << " balls/s";
+    if (balls < target_balls_ && throughput > 0) {
+      out_ << ", " << (target_balls_ - balls) / throughput << " s left";
+    }
+    uint64_t read_bytes, written_bytes;
+    if (report_io_ && read_io_counters(read_bytes, written_bytes)) {
+      out_ << ", " << (read_bytes - start_read_bytes_) / elapsed / 1e6 << " MB/s read, "
+           << (written_bytes - start_written_bytes_) / elapsed / 1e6 << " MB/s written";
+    }
+    out_ << ")" << std::endl;
+  }
+
+private:
+
+  const double period_;
+  bool report_io_;
+  std::ostream& out_;
+  std::string label_;
+  uint64_t target_balls_ = 0;
+  std::chrono::steady_clock::time_point start_, last_report_;
+  uint64_t start_read_bytes_ = 0, start_written_bytes_ = 0;
+};
+
+/* Number of rounds simulated between progress updates. */
+constexpr uint64_t kProgressChunk = uint64_t(1) << 20;
+
+/* Runs the given number of rounds, updating `progress` (if not null) after
+   every chunk of rounds. */
+template<typename Process, typename Generator>
+void run_with_progress(Process& process, Generator& generator, uint64_t rounds, ProgressReporter* progress) {
+  while (rounds > 0) {
+    uint64_t chunk = progress == nullptr ? rounds : std::min(rounds, kProgressChunk);
+    for (uint64_t round = 0; round < chunk; ++round) {
+      process.nextRound(generator);
+    }
+    rounds -= chunk;
+    if (progress != nullptr) progress->update(process.getTotalBalls());
+  }
+}
+
+#endif  // NOISE22_PROGRESS_H_
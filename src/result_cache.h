@@ -0,0 +1,177 @@
+/* Content-addressed on-disk cache of the gaps of simulation runs, so that
+   extending an experiment (more runs, more parameters) only computes the
+   runs that are not cached. */
+#ifndef NOISE22_RESULT_CACHE_H_
+#define NOISE22_RESULT_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+
+#include "seeding.h"
+
+/* Returns a stable name for the generator type, which is part of the key of
+   cached results. */
+template<typename Generator>
+std::string generator_name() {
+  return typeid(Generator).name();
+}
+
+template<>
+inline std::string generator_name<std::mt19937>() {
+  return "mt19937";
+}
+
+template<>
+inline std::string generator_name<std::mt19937_64>() {
+  return "mt19937_64";
+}
+
+/* Everything that determines the gaps of the runs of a configuration. The
+   i-th run of a configuration uses a seed derived from `seed` and i, so
+   runs are shared by experiments that differ only in the number of runs. */
+struct CacheKey {
+  /* Kind of process, e.g., "two-sample" or "batched". */
+  std::string process;
+  /* Decider of the process, e.g., "sigma-noisy". */
+  std::string decider;
+  /* Parameter of the decider (g or sigma) or the batch size. */
+  long long param;
+  /* Number of bins. */
+  uint64_t n;
+  /* Number of balls when the gap is measured. */
+  uint64_t m;
+  /* Batch size (1 for sequential processes). */
+  uint64_t b;
+  /* Type of the generator. */
+  std::string generator;
+  /* Base seed of the runs. */
+  uint64_t seed;
+  /* Any other option that affects the measured gap (e.g., burn-in detection). */
+  std::string variant;
+
+  /* Returns the canonical string representation of the key. */
+  std::string canonical() const {
+    std::ostringstream out;
+    out << "process=" << process << ";decider=" << decider << ";param=" << param
+        << ";n=" << n << ";m=" << m << ";b=" << b << ";generator=" << generator
+        << ";seed=" << seed << ";variant=" << variant;
+    return out.str();
+  }
+};
+
+/* Cache of run results in a directory, with one file per configuration
+   named after the hash of its key. A file starts with the canonical key
+   (to detect hash collisions) followed by lines "<run> <gap>". Files are
+   only appended to, so concurrent experiments can share a cache (and the
+   threads of an experiment can share the object). */
+class ResultCache {
+public:
+
+  explicit ResultCache(const std::string& directory) : directory_(directory) {
+    std::filesystem::create_directories(directory_);
+  }
+
+  /* Returns the cached gap of the given run, if any. */
+  std::optional<int> find(const CacheKey& key, uint64_t run) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::map<uint64_t, int>& runs = load(key);
+    auto it = runs.find(run);
+    if (it == runs.end()) return std::nullopt;
+    return it->second;
+  }
+
+  /* Returns the number of cached runs of the configuration. */
+  size_t count(const CacheKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return load(key).size();
+  }
+
+  /* Adds the gap of the given run to the cache. */
+  void store(const CacheKey& key, uint64_t run, int gap) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<uint64_t, int>& runs = load(key);
+    std::string path = pathOf(key);
+    bool exists = std::filesystem::exists(path);
+    std::ofstream out(path, std::ios::app);
+    if (!exists) {
+      out << key.canonical() << "\n";
+    } else if (partial_.erase(key.canonical()) > 0) {
+      // Terminate a partially written line so that it stays malformed.
+      out << "\n";
+    }
+    out << run << " " << gap << "\n";
+    if (!out) throw std::runtime_error("Failed to write to cache file " + path);
+    runs[run] = gap;
+  }
+
+private:
+
+  /* Returns the path of the file for the key. */
+  std::string pathOf(const CacheKey& key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.runs", (unsigned long long) hash_string(key.canonical()));
+    return (std::filesystem::path(directory_) / name).string();
+  }
+
+  /* Returns the cached runs of the configuration, reading its file on the
+     first access. */
+  std::map<uint64_t, int>& load(const CacheKey& key) {
+    std::string canonical = key.canonical();
+    auto it = entries_.find(canonical);
+    if (it != entries_.end()) return it->second;
+    std::map<uint64_t, int>& runs = entries_[canonical];
+    std::ifstream in(pathOf(key), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (contents.empty()) return runs;
+    if (contents.back() != '\n') {
+      partial_.insert(canonical);
+    }
+    // Only lines terminated by a newline were completely written.
+    size_t begin = 0, end;
+    bool header = true;
+    while ((end = contents.find('\n', begin)) != std::string::npos) {
+      std::string line = contents.substr(begin, end - begin);
+      begin = end + 1;
+      if (header) {
+        if (line != canonical) {
+          throw std::runtime_error("Hash collision in result cache for " + canonical);
+        }
+        header = false;
+        continue;
+      }
+      std::istringstream fields(line);
+      uint64_t run;
+      int gap;
+      if (fields >> run >> gap) {
+        runs[run] = gap;
+      }
+    }
+    return runs;
+  }
+
+  /* Directory of the cache. */
+  const std::string directory_;
+
+  /* Runs of the configurations accessed so far, keyed by canonical key. */
+  std::map<std::string, std::map<uint64_t, int>> entries_;
+
+  /* Configurations whose file ends with a partially written line. */
+  std::set<std::string> partial_;
+
+  /* Guards the entries and the files. */
+  std::mutex mutex_;
+};
+
+#endif  // NOISE22_RESULT_CACHE_H_
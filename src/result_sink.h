@@ -0,0 +1,384 @@
+/* Machine-readable output of the gap distributions of the experiments.
+
+   Every configuration is written as one row per observed gap with the
+   number of runs (or samples) that had that gap, which is lossless for the
+   distributions and the mean gaps. Sinks are buffered and append each block
+   of complete rows with a single write() to a file opened with O_APPEND,
+   which the kernel appends as a whole (for local files, regardless of the
+   size of the block), so several processes can write to the same file.
+   Hosts that share a network filesystem should write separate files that
+   are merged afterwards, since O_APPEND is not atomic on NFS. Three
+   formats are supported, chosen by the file extension:
+     - ".csv": comma-separated values with a header line,
+     - ".jsonl": one JSON object per line,
+     - anything else: columnar binary, a sequence of self-contained blocks
+       each storing every column contiguously. */
+#ifndef NOISE22_RESULT_SINK_H_
+#define NOISE22_RESULT_SINK_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+/* Number of runs of a configuration that had a given gap. */
+struct ResultRow {
+  /* Name of the experiment, e.g., "sigma-noisy" or "batched-two-choice". */
+  std::string experiment;
+  /* Parameter of the experiment (g, sigma or the batch size). */
+  long long param;
+  /* Number of bins. */
+  uint64_t n;
+  /* Number of balls when the gap is measured. */
+  uint64_t m;
+  int gap;
+  uint64_t count;
+
+  /* Returns the configuration and gap, which identify a row. */
+  std::tuple<std::string, long long, uint64_t, uint64_t, int> key() const {
+    return { experiment, param, n, m, gap };
+  }
+};
+
+/* Buffered destination of result rows. */
+class ResultSink {
+public:
+
+  explicit ResultSink(const std::string& path) : path_(path) {
+#if defined(_WIN32)
+    fd_ = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+    if (fd_ < 0) throw std::runtime_error("Failed to open results file " + path);
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    empty_ = !in || in.tellg() == 0;
+    partial_ = !empty_ && in.seekg(-1, std::ios::end) && in.get() != '\n';
+  }
+
+  ResultSink(const ResultSink&) = delete;
+  ResultSink& operator=(const ResultSink&) = delete;
+
+  virtual ~ResultSink() {
+#if defined(_WIN32)
+    _close(fd_);
+#else
+    close(fd_);
+#endif
+  }
+
+  /* Adds a row, which is written at the next flush. Rows can be written
+     from several threads. */
+  void write(const ResultRow& row) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rows_.push_back(row);
+    if (rows_.size() >= kBufferedRows) flushRows();
+  }
+
+  /* Appends the buffered rows to the file. */
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushRows();
+  }
+
+protected:
+
+  /* Returns the encoding of the rows as appended to the file. */
+  virtual std::string encode(const std::vector<ResultRow>& rows) const = 0;
+
+  /* Whether nothing has been written to the file yet. */
+  bool empty_;
+
+  /* Whether the file ends with a partially written row (or line). */
+  bool partial_;
+
+private:
+
+  static constexpr size_t kBufferedRows = 4'096;
+
+  /* Appends the buffered rows with a single write (continuing only after
+     a partial write, e.g., on a full disk). Must hold `mutex_`. */
+  void flushRows() {
+    if (rows_.empty()) return;
+    std::string data = encode(rows_);
+    const char* remaining = data.data();
+    size_t size = data.size();
+    while (size > 0) {
+#if defined(_WIN32)
+      long long written = _write(fd_, remaining, unsigned(size));
+#else
+      long long written = ::write(fd_, remaining, size);
+#endif
+      if (written <= 0) throw std::runtime_error("Failed to write results file " + path_);
+      remaining += written;
+      size -= written;
+    }
+    empty_ = false;
+    partial_ = false;
+    rows_.clear();
+  }
+
+  const std::string path_;
+  /* File descriptor opened for appending. */
+  int fd_;
+  std::vector<ResultRow> rows_;
+  std::mutex mutex_;
+};
+
+constexpr char kCsvHeader[] = "experiment,param,n,m,gap,count";
+
+class CsvSink : public ResultSink {
+public:
+
+  explicit CsvSink(const std::string& path) : ResultSink(path) {
+
+  }
+
+  ~CsvSink() override {
+    flush();
+  }
+
+protected:
+
+  std::string encode(const std::vector<ResultRow>& rows) const override {
+    std::ostringstream out;
+    // Terminate a partially written line so that it stays malformed.
+    if (partial_) out << "\n";
+    if (empty_) out << kCsvHeader << "\n";
+    for (const auto& row : rows) {
+      out << row.experiment << "," << row.param << "," << row.n << "," << row.m << "," << row.gap << "," << row.count << "\n";
+    }
+    return out.str();
+  }
+};
+
+class JsonLinesSink : public ResultSink {
+public:
+
+  explicit JsonLinesSink(const std::string& path) : ResultSink(path) {
+
+  }
+
+  ~JsonLinesSink() override {
+    flush();
+  }
+
+protected:
+
+  std::string encode(const std::vector<ResultRow>& rows) const override {
+    std::ostringstream out;
+    if (partial_) out << "\n";
+    for (const auto& row : rows) {
+      // Experiment names are plain identifiers, so they need no escaping.
+      out << "{\"experiment\":\"" << row.experiment << "\",\"param\":" << row.param << ",\"n\":" << row.n
+          << ",\"m\":" << row.m << ",\"gap\":" << row.gap << ",\"count\":" << row.count << "}\n";
+    }
+    return out.str();
+  }
+};
+
+constexpr char kColumnarMagic[8] = { 'N', 'O', 'I', 'S', 'E', '2', '2', 'R' };
+
+/* Block of the columnar format: the magic, the number of rows r, the total
+   size of the block, and then the columns as arrays of r values (with the
+   experiment names as a 32-bit length followed by the characters). */
+class ColumnarSink : public ResultSink {
+public:
+
+  explicit ColumnarSink(const std::string& path) : ResultSink(path) {
+
+  }
+
+  ~ColumnarSink() override {
+    flush();
+  }
+
+protected:
+
+  std::string encode(const std::vector<ResultRow>& rows) const override {
+    std::string block(kColumnarMagic, sizeof(kColumnarMagic));
+    append<uint64_t>(block, rows.size());
+    size_t size_offset = block.size();
+    append<uint64_t>(block, 0);
+    for (const auto& row : rows) {
+      append<uint32_t>(block, uint32_t(row.experiment.size()));
+      block += row.experiment;
+    }
+    for (const auto& row : rows) append<int64_t>(block, row.param);
+    for (const auto& row : rows) append<uint64_t>(block, row.n);
+    for (const auto& row : rows) append<uint64_t>(block, row.m);
+    for (const auto& row : rows) append<int32_t>(block, row.gap);
+    for (const auto& row : rows) append<uint64_t>(block, row.count);
+    uint64_t size = block.size();
+    std::memcpy(&block[size_offset], &size, sizeof(size));
+    return block;
+  }
+
+private:
+
+  template<typename T>
+  static void append(std::string& block, T value) {
+    block.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+};
+
+/* Returns a sink for the format given by the extension of the path. */
+inline std::unique_ptr<ResultSink> make_result_sink(const std::string& path) {
+  auto ends_with = [&path](const std::string& suffix) {
+    return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  if (ends_with(".csv")) return std::make_unique<CsvSink>(path);
+  if (ends_with(".jsonl")) return std::make_unique<JsonLinesSink>(path);
+  return std::make_unique<ColumnarSink>(path);
+}
+
+namespace internal {
+
+inline std::vector<ResultRow> parse_csv_results(const std::string& contents) {
+  std::vector<ResultRow> rows;
+  std::istringstream in(contents);
+  std::string line;
+  while (std::getline(in, line)) {
+    // A line without its newline was only partially written.
+    if (in.eof() || line == kCsvHeader) continue;
+    for (auto& c : line) {
+      if (c == ',') c = ' ';
+    }
+    std::istringstream fields(line);
+    ResultRow row;
+    if (fields >> row.experiment >> row.param >> row.n >> row.m >> row.gap >> row.count) rows.push_back(row);
+  }
+  return rows;
+}
+
+inline std::vector<ResultRow> parse_json_lines_results(const std::string& contents) {
+  std::vector<ResultRow> rows;
+  std::istringstream in(contents);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (in.eof() || line.empty() || line.front() != '{' || line.back() != '}') continue;
+    // Reads the value of the given field of the flat object.
+    auto field = [&line](const std::string& name) {
+      size_t start = line.find("\"" + name + "\":");
+      if (start == std::string::npos) throw std::runtime_error("Missing field " + name + " in " + line);
+      start += name.size() + 3;
+      size_t end = line.find_first_of(",}", start);
+      std::string value = line.substr(start, end - start);
+      if (!value.empty() && value.front() == '"') value = value.substr(1, value.size() - 2);
+      return value;
+    };
+    rows.push_back({ field("experiment"), std::stoll(field("param")), std::stoull(field("n")), std::stoull(field("m")),
+                     std::stoi(field("gap")), std::stoull(field("count")) });
+  }
+  return rows;
+}
+
+inline std::vector<ResultRow> parse_columnar_results(const std::string& contents) {
+  std::vector<ResultRow> rows;
+  size_t offset = 0;
+  auto read = [&contents, &offset](auto& value, size_t end) {
+    if (offset + sizeof(value) > end) throw std::runtime_error("Corrupted columnar results block.");
+    std::memcpy(&value, contents.data() + offset, sizeof(value));
+    offset += sizeof(value);
+  };
+  // Returns the offset of the first block header at or after `from`.
+  auto next_block = [&contents](size_t from) {
+    size_t found = contents.find(std::string(kColumnarMagic, sizeof(kColumnarMagic)), from);
+    return found == std::string::npos ? contents.size() : found;
+  };
+  while (offset + sizeof(kColumnarMagic) + 2 * sizeof(uint64_t) <= contents.size()) {
+    size_t start = offset;
+    if (std::memcmp(contents.data() + offset, kColumnarMagic, sizeof(kColumnarMagic)) != 0) {
+      throw std::runtime_error("Not a columnar results file.");
+    }
+    offset += sizeof(kColumnarMagic);
+    uint64_t num_rows, size;
+    read(num_rows, contents.size());
+    read(size, contents.size());
+    // A block that was only partially written (e.g., after a crash) is
+    // skipped, and later appends start at the next block header.
+    if (start + size > contents.size() || (start + size < contents.size()
+        && contents.compare(start + size, sizeof(kColumnarMagic), kColumnarMagic, sizeof(kColumnarMagic)) != 0)) {
+      offset = next_block(start + sizeof(kColumnarMagic));
+      continue;
+    }
+    size_t end = start + size;
+    size_t first = rows.size();
+    rows.resize(first + num_rows);
+    for (uint64_t i = 0; i < num_rows; ++i) {
+      uint32_t length;
+      read(length, end);
+      if (offset + length > end) throw std::runtime_error("Corrupted columnar results block.");
+      rows[first + i].experiment = contents.substr(offset, length);
+      offset += length;
+    }
+    for (uint64_t i = 0; i < num_rows; ++i) {
+      int64_t param;
+      read(param, end);
+      rows[first + i].param = param;
+    }
+    for (uint64_t i = 0; i < num_rows; ++i) read(rows[first + i].n, end);
+    for (uint64_t i = 0; i < num_rows; ++i) read(rows[first + i].m, end);
+    for (uint64_t i = 0; i < num_rows; ++i) {
+      int32_t gap;
+      read(gap, end);
+      rows[first + i].gap = gap;
+    }
+    for (uint64_t i = 0; i < num_rows; ++i) read(rows[first + i].count, end);
+    offset = end;
+  }
+  return rows;
+}
+
+}  // namespace internal
+
+/* Reads the rows of a results file in any of the formats. Partially
+   written trailing rows or blocks are ignored. */
+inline std::vector<ResultRow> read_results(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Failed to open results file " + path);
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (contents.compare(0, sizeof(kColumnarMagic), kColumnarMagic, sizeof(kColumnarMagic)) == 0) {
+    return internal::parse_columnar_results(contents);
+  }
+  if (!contents.empty() && contents[0] == '{') {
+    return internal::parse_json_lines_results(contents);
+  }
+  return internal::parse_csv_results(contents);
+}
+
+/* Merges rows with the same configuration and gap by adding their counts,
+   and returns them ordered by configuration and gap. The inputs must come
+   from disjoint sets of runs (e.g., different seeds or shards). */
+inline std::vector<ResultRow> merge_results(const std::vector<ResultRow>& rows) {
+  std::map<std::tuple<std::string, long long, uint64_t, uint64_t, int>, ResultRow> merged;
+  for (const auto& row : rows) {
+    auto [it, inserted] = merged.try_emplace(row.key(), row);
+    if (!inserted) it->second.count += row.count;
+  }
+  std::vector<ResultRow> result;
+  for (const auto& [key, row] : merged) {
+    result.push_back(row);
+  }
+  return result;
+}
+
+#endif  // NOISE22_RESULT_SINK_H_
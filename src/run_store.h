@@ -0,0 +1,76 @@
+/* Lookup and recording of run results in the sweep journal and the result
+   cache, shared by the experiment drivers. */
+#ifndef NOISE22_RUN_STORE_H_
+#define NOISE22_RUN_STORE_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "journal.h"
+#include "result_cache.h"
+
+/* A gap measured during a run. */
+struct Measurement {
+  /* Name of the measured process in the journal, e.g., "batched-two-choice". */
+  std::string name;
+  /* Key of the measurement in the result cache, whose `m` is the number of
+     balls at the time of the measurement. */
+  CacheKey key;
+};
+
+/* Returns the variant of a measurement in the journal: the generator type
+   followed by the variant of its cache key, if any. */
+inline std::string journal_variant(const CacheKey& key) {
+  return key.variant.empty() ? key.generator : key.generator + "," + key.variant;
+}
+
+/* Looks up runs in the journal and then in the cache (each may be null). */
+class RunStore {
+public:
+
+  RunStore(Journal* journal, ResultCache* cache) : journal_(journal), cache_(cache) {
+
+  }
+
+  /* Sets `gaps` to the stored gaps of all measurements of the run (with the
+     given seed) and returns true, or returns false if any of them is
+     missing. */
+  bool lookup(const std::vector<Measurement>& measurements, uint64_t run, uint64_t seed, std::vector<int>& gaps) const {
+    gaps.clear();
+    for (const auto& measurement : measurements) {
+      const CacheKey& key = measurement.key;
+      const RunRecord* record = journal_ == nullptr ? nullptr : journal_->find(measurement.name, key.param, key.n, key.m, run, seed, journal_variant(key));
+      if (record != nullptr) {
+        gaps.push_back(record->gap);
+        continue;
+      }
+      std::optional<int> cached = cache_ == nullptr ? std::nullopt : cache_->find(key, run);
+      if (!cached) return false;
+      gaps.push_back(*cached);
+    }
+    return true;
+  }
+
+  /* Adds the gaps of the run to the cache and journal, unless already there. */
+  void record(const std::vector<Measurement>& measurements, uint64_t run, uint64_t seed, const std::vector<int>& gaps) const {
+    for (size_t i = 0; i < measurements.size(); ++i) {
+      const CacheKey& key = measurements[i].key;
+      if (cache_ != nullptr && !cache_->find(key, run)) {
+        cache_->store(key, run, gaps[i]);
+      }
+      std::string variant = journal_variant(key);
+      if (journal_ != nullptr && journal_->find(measurements[i].name, key.param, key.n, key.m, run, seed, variant) == nullptr) {
+        journal_->append({ measurements[i].name, key.param, key.n, key.m, run, seed, gaps[i], variant });
+      }
+    }
+  }
+
+private:
+
+  Journal* journal_;
+  ResultCache* cache_;
+};
+
+#endif  // NOISE22_RUN_STORE_H_
@@ -0,0 +1,291 @@
+/* Parallel execution of the configurations of a sweep within a memory
+   budget.
+
+   The configurations of a sweep are very heterogeneous (from n = 10^4 bins,
+   taking 80 KB and seconds, to n = 10^9 bins, taking GBs and hours), so
+   running them in a plain parallel loop either runs out of memory or
+   leaves threads idle at the end. Instead, each job gets an estimate of its
+   memory and running time from a `CostModel`, and the `SweepScheduler`:
+     - orders the jobs longest first (LPT), so that the long jobs do not
+       start last,
+     - deals them to per-thread queues, from which each thread takes its
+       longest job that fits in the remaining memory, and steals the
+       shortest fitting job of the thread with the most remaining work once
+       its own queue is empty (or nothing in it fits),
+     - only starts a job if the estimated memory of the running jobs stays
+       within the budget.
+   The same policy is simulated with the estimates to project the makespan
+   before starting. The threads are pinned to the NUMA nodes with the given
+   `PlacementPolicy`, and every job runs (and allocates its load vectors)
+   on a single thread, so its memory stays on the node of that thread. */
+#ifndef NOISE22_SCHEDULER_H_
+#define NOISE22_SCHEDULER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "numa.h"
+
+/* Estimated resources of a job. */
+struct JobEstimate {
+  uint64_t memory_bytes = 0;
+  double seconds = 0.0;
+};
+
+/* Estimates the resources of simulating the processes. The default
+   constants were measured for the Two-Choice processes on a single core:
+   each ball costs a few cache hits while the load vector fits in the cache
+   and a few memory accesses (TLB and cache misses) once it does not, and
+   the buffered batched setting additionally scans the load vector once per
+   batch. */
+struct CostModel {
+  double seconds_per_ball_in_cache = 4e-8;
+  double seconds_per_ball_in_memory = 3e-7;
+  double seconds_per_bin_scanned = 1e-9;
+  uint64_t cache_bytes = uint64_t(32) << 20;
+
+  /* Returns the estimate for allocating `balls` balls with a process with
+     `n` bins, one ball at a time. */
+  JobEstimate estimateTwoSample(uint64_t n, uint64_t balls) const {
+    uint64_t memory = n * sizeof(size_t);
+    return { memory, balls * secondsPerBall(memory) };
+  }
+
+  /* Returns the estimate for allocating `balls` balls in batches of `b`
+     with `n` bins, which merges a buffer vector after every batch (unless
+     the batches are `partitioned`, see `BasicBatchedTwoChoiceSetting`). */
+  JobEstimate estimateBatched(uint64_t n, uint64_t b, uint64_t balls, bool partitioned = false) const {
+    uint64_t memory = n * sizeof(size_t);
+    double seconds = balls * secondsPerBall(memory);
+    if (partitioned) {
+      // The samples, lookups, loads and choices of a batch.
+      return { memory + b * 6 * sizeof(size_t), seconds };
+    }
+    return { 2 * memory, seconds + double(balls / std::max<uint64_t>(b, 1)) * n * seconds_per_bin_scanned };
+  }
+
+  double secondsPerBall(uint64_t memory_bytes) const {
+    return memory_bytes <= cache_bytes ? seconds_per_ball_in_cache : seconds_per_ball_in_memory;
+  }
+};
+
+/* A job of a sweep. */
+struct SweepJob {
+  std::string name;
+  JobEstimate estimate;
+  std::function<void()> run;
+};
+
+/* Projected execution of the jobs. */
+struct SchedulePlan {
+  double makespan_seconds;
+  /* Sum of the estimated running times (the makespan on one thread). */
+  double total_seconds;
+  /* Largest estimated memory of the jobs running at the same time. */
+  uint64_t peak_memory_bytes;
+};
+
+class SweepScheduler {
+public:
+
+  SweepScheduler(size_t num_threads, uint64_t memory_budget, PlacementPolicy placement = thread_placement())
+    : num_threads_(std::max<size_t>(1, num_threads)), memory_budget_(memory_budget), placement_(placement) {
+
+  }
+
+  /* Adds a job, which must fit in the memory budget on its own. */
+  void add(SweepJob job) {
+    if (job.estimate.memory_bytes > memory_budget_) {
+      throw std::runtime_error("Job " + job.name + " needs " + std::to_string(job.estimate.memory_bytes)
+        + " bytes, more than the memory budget of " + std::to_string(memory_budget_) + " bytes.");
+    }
+    jobs_.push_back(std::move(job));
+  }
+
+  size_t size() const {
+    return jobs_.size();
+  }
+
+  size_t getNumThreads() const {
+    return num_threads_;
+  }
+
+  uint64_t getMemoryBudget() const {
+    return memory_budget_;
+  }
+
+  /* Simulates the schedule with the estimated running times. */
+  SchedulePlan plan() const {
+    SchedulePlan plan = { 0.0, 0.0, 0 };
+    std::vector<const SweepJob*> pending;
+    for (const auto& job : jobs_) {
+      pending.push_back(&job);
+      plan.total_seconds += job.estimate.seconds;
+    }
+    sortLongestFirst(pending);
+    // End times and memory of the running jobs.
+    std::vector<std::pair<double, uint64_t>> running;
+    double now = 0.0;
+    uint64_t memory = 0;
+    while (!pending.empty() || !running.empty()) {
+      // Starts the longest pending jobs that fit, while threads are free.
+      for (auto it = pending.begin(); it != pending.end() && running.size() < num_threads_;) {
+        if (memory + (*it)->estimate.memory_bytes <= memory_budget_) {
+          memory += (*it)->estimate.memory_bytes;
+          running.push_back({ now + (*it)->estimate.seconds, (*it)->estimate.memory_bytes });
+          it = pending.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      plan.peak_memory_bytes = std::max(plan.peak_memory_bytes, memory);
+      // Advances to the next completion.
+      auto next = std::min_element(running.begin(), running.end());
+      now = next->first;
+      memory -= next->second;
+      running.erase(next);
+    }
+    plan.makespan_seconds = now;
+    return plan;
+  }
+
+  /* Runs all jobs and waits for them. If jobs throw, the remaining jobs
+     are skipped and the first exception is rethrown. */
+  void run() {
+    std::vector<SweepJob*> order;
+    for (auto& job : jobs_) {
+      order.push_back(&job);
+    }
+    sortLongestFirst(order);
+    queues_.assign(num_threads_, {});
+    for (size_t i = 0; i < order.size(); ++i) {
+      queues_[i % num_threads_].push_back(order[i]);
+    }
+    memory_in_use_ = 0;
+    failure_ = nullptr;
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < num_threads_; ++thread) {
+      threads.emplace_back(&SweepScheduler::work, this, thread);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    jobs_.clear();
+    if (failure_ != nullptr) std::rethrow_exception(failure_);
+  }
+
+private:
+
+  template<typename Job>
+  static void sortLongestFirst(std::vector<Job*>& jobs) {
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job* a, const Job* b) {
+      return a->estimate.seconds > b->estimate.seconds;
+    });
+  }
+
+  /* Removes and returns the next job for the thread, or null if it should
+     wait for memory to be released. Must hold `mutex_`. */
+  SweepJob* takeJob(size_t thread) {
+    auto fits = [this](const SweepJob* job) {
+      return memory_in_use_ + job->estimate.memory_bytes <= memory_budget_;
+    };
+    // The longest fitting job of the own queue.
+    auto& own = queues_[thread];
+    auto it = std::find_if(own.begin(), own.end(), fits);
+    if (it != own.end()) {
+      SweepJob* job = *it;
+      own.erase(it);
+      return job;
+    }
+    // The shortest fitting job of the queue with the most remaining work.
+    std::vector<size_t> victims;
+    for (size_t other = 0; other < queues_.size(); ++other) {
+      if (other != thread && !queues_[other].empty()) victims.push_back(other);
+    }
+    std::sort(victims.begin(), victims.end(), [this](size_t a, size_t b) {
+      return remainingSeconds(a) > remainingSeconds(b);
+    });
+    for (size_t victim : victims) {
+      auto& queue = queues_[victim];
+      auto stolen = std::find_if(queue.rbegin(), queue.rend(), fits);
+      if (stolen != queue.rend()) {
+        SweepJob* job = *stolen;
+        queue.erase(std::next(stolen).base());
+        return job;
+      }
+    }
+    return nullptr;
+  }
+
+  double remainingSeconds(size_t thread) const {
+    double seconds = 0.0;
+    for (const SweepJob* job : queues_[thread]) {
+      seconds += job->estimate.seconds;
+    }
+    return seconds;
+  }
+
+  bool allQueuesEmpty() const {
+    return std::all_of(queues_.begin(), queues_.end(), [](const std::deque<SweepJob*>& queue) { return queue.empty(); });
+  }
+
+  /* Body of a worker thread. */
+  void work(size_t thread) {
+    pin_worker_thread(placement_, thread, num_threads_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (failure_ != nullptr || allQueuesEmpty()) break;
+      SweepJob* job = takeJob(thread);
+      if (job == nullptr) {
+        memory_released_.wait(lock);
+        continue;
+      }
+      memory_in_use_ += job->estimate.memory_bytes;
+      lock.unlock();
+      std::exception_ptr failure = nullptr;
+      try {
+        job->run();
+      } catch (...) {
+        failure = std::current_exception();
+      }
+      lock.lock();
+      memory_in_use_ -= job->estimate.memory_bytes;
+      if (failure != nullptr && failure_ == nullptr) failure_ = failure;
+      memory_released_.notify_all();
+    }
+    memory_released_.notify_all();
+  }
+
+  const size_t num_threads_;
+  const uint64_t memory_budget_;
+  const PlacementPolicy placement_;
+  std::vector<SweepJob> jobs_;
+
+  /* State of `run`, guarded by `mutex_`. */
+  std::mutex mutex_;
+  std::condition_variable memory_released_;
+  std::vector<std::deque<SweepJob*>> queues_;
+  uint64_t memory_in_use_ = 0;
+  std::exception_ptr failure_;
+};
+
+/* Prints the projected schedule of the jobs, before running them. */
+inline void print_schedule_plan(const SweepScheduler& scheduler, std::ostream& out) {
+  constexpr double kGigabyte = double(uint64_t(1) << 30);
+  SchedulePlan plan = scheduler.plan();
+  out << "Scheduling " << scheduler.size() << " jobs on " << scheduler.getNumThreads() << " threads within "
+      << scheduler.getMemoryBudget() / kGigabyte << " GB : projected makespan " << plan.makespan_seconds << " s ("
+      << plan.total_seconds << " s of work, peak memory " << plan.peak_memory_bytes / kGigabyte << " GB)" << std::endl;
+}
+
+#endif  // NOISE22_SCHEDULER_H_
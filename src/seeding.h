@@ -0,0 +1,37 @@
+/* Deterministic derivation of random seeds for the runs of an experiment,
+   so that every run can be reproduced (or skipped) independently. */
+#ifndef NOISE22_SEEDING_H_
+#define NOISE22_SEEDING_H_
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+/* Returns the SplitMix64 mixing of the given value. */
+inline uint64_t mix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/* Returns the 64-bit FNV-1a hash of the string. */
+inline uint64_t hash_string(const std::string& s) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : s) {
+    hash = (hash ^ c) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* Returns a seed derived from the base seed and the given components
+   (e.g., the hash of the process name, the parameter, n and the run). */
+inline uint64_t derive_seed(uint64_t base_seed, std::initializer_list<uint64_t> components) {
+  uint64_t seed = mix64(base_seed);
+  for (auto component : components) {
+    seed = mix64(seed ^ component);
+  }
+  return seed;
+}
+
+#endif  // NOISE22_SEEDING_H_
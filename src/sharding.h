@@ -0,0 +1,60 @@
+/* Splitting of a sweep of independent runs between processes, e.g., on
+   hosts that only share a filesystem.
+
+   Every run of a configuration has its own seed derived from the base seed,
+   the configuration and the run index, so shard k of K simply computes the
+   runs whose seed hashes to k modulo K. Each shard writes the distributions
+   of its runs to its own result file (with --results), and merging the
+   files (which sums the counts of identical rows) gives exactly the
+   distributions of the unsharded sweep, for example with
+   `FormatResults --tables`. The shards cannot stop adaptively, so every
+   configuration considers exactly `max_runs` runs. */
+#ifndef NOISE22_SHARDING_H_
+#define NOISE22_SHARDING_H_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "seeding.h"
+#include "statistics.h"
+
+/* Shard `index` of `count`, where the default is the whole sweep. */
+struct Shard {
+  uint64_t index = 0;
+  uint64_t count = 1;
+
+  bool isSharded() const {
+    return count > 1;
+  }
+
+  /* Returns whether this shard computes the run with the given seed. */
+  bool owns(uint64_t seed) const {
+    return mix64(seed) % count == index;
+  }
+
+  /* Returns true if no more runs of a configuration are needed before
+     `run`, given the statistics of the runs so far. */
+  bool shouldStop(const SequentialStopping& stopping, uint64_t run, const GapStatistics& statistics) const {
+    return isSharded() ? run >= stopping.max_runs : stopping.shouldStop(statistics);
+  }
+};
+
+/* Parses "k/K" with 0 <= k < K. */
+inline Shard parse_shard(const std::string& spec) {
+  size_t slash = spec.find('/');
+  Shard shard;
+  try {
+    if (slash == std::string::npos) throw std::invalid_argument(spec);
+    shard.index = std::stoull(spec.substr(0, slash));
+    shard.count = std::stoull(spec.substr(slash + 1));
+  } catch (const std::logic_error&) {
+    throw std::runtime_error("Invalid shard " + spec + ", expected k/K");
+  }
+  if (shard.count == 0 || shard.index >= shard.count) {
+    throw std::runtime_error("Invalid shard " + spec + ", expected 0 <= k < K");
+  }
+  return shard;
+}
+
+#endif  // NOISE22_SHARDING_H_
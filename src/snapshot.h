@@ -0,0 +1,271 @@
+/* Compressed snapshots of load vectors for offline analysis.
+
+   The loads are split into blocks of `block_size` bins, and each block is
+   stored relative to its minimum load (the base) in whichever is smaller of:
+     - bit-packed offsets, using the fewest bits that fit the largest one, or
+     - run-length encoded (offset, length) pairs as varints.
+   In a stationary state the loads of all bins are within a few units of
+   the average, so the packed offsets need 2-5 bits per bin (instead of 64),
+   while the runs compress the many equal loads early in a run.
+
+   A snapshot file consists of a `SnapshotHeader`, the blocks, and an index
+   with the offset of every block (and of the end of the last one), so any
+   block can be decoded on its own. */
+#ifndef NOISE22_SNAPSHOT_H_
+#define NOISE22_SNAPSHOT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/* Fixed-size header of a snapshot file. */
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t num_bins;
+  uint64_t total_balls;
+  uint64_t max_load;
+  uint64_t num_blocks;
+  /* Offset of the block index from the beginning of the file. */
+  uint64_t index_offset;
+};
+
+constexpr char kSnapshotMagic[8] = { 'N', 'O', 'I', 'S', 'E', '2', '2', 'S' };
+constexpr uint32_t kSnapshotVersion = 1;
+
+/* Encoding of a block. */
+enum class SnapshotBlockMode : uint8_t {
+  kPacked = 0,
+  kRuns = 1
+};
+
+namespace internal {
+
+inline void append_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline uint64_t read_varint(const char*& in, const char* end) {
+  uint64_t value = 0;
+  for (int shift = 0; in != end && shift < 64; shift += 7) {
+    unsigned char byte = static_cast<unsigned char>(*in++);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return value;
+  }
+  throw std::runtime_error("Corrupted snapshot block.");
+}
+
+/* Returns the `width`-bit value at position `index` of the packed words,
+   which may be unaligned in memory. */
+inline uint64_t unpack(const char* words, uint64_t index, unsigned width) {
+  if (width == 0) return 0;
+  uint64_t bit = index * width;
+  uint64_t low, high = 0;
+  std::memcpy(&low, words + bit / 64 * sizeof(uint64_t), sizeof(low));
+  unsigned shift = bit % 64;
+  uint64_t value = low >> shift;
+  if (shift + width > 64) {
+    std::memcpy(&high, words + (bit / 64 + 1) * sizeof(uint64_t), sizeof(high));
+    value |= high << (64 - shift);
+  }
+  return width == 64 ? value : value & ((uint64_t(1) << width) - 1);
+}
+
+/* Appends the encoding of the loads of a block to `out`. */
+template<typename Load>
+void encode_snapshot_block(const Load* loads, size_t count, std::string& out) {
+  uint64_t base = *std::min_element(loads, loads + count);
+  uint64_t largest = *std::max_element(loads, loads + count) - base;
+  unsigned width = 0;
+  while (width < 64 && (largest >> width) != 0) ++width;
+
+  std::string runs;
+  size_t num_runs = 0;
+  for (size_t begin = 0, end; begin < count; begin = end) {
+    for (end = begin + 1; end < count && loads[end] == loads[begin]; ++end);
+    append_varint(runs, loads[begin] - base);
+    append_varint(runs, end - begin);
+    ++num_runs;
+  }
+  size_t packed_bytes = (count * width + 63) / 64 * sizeof(uint64_t);
+
+  // The run count takes at most 10 bytes and the width 1 byte.
+  bool use_runs = runs.size() + 10 < packed_bytes + 1;
+  out.push_back(static_cast<char>(use_runs ? SnapshotBlockMode::kRuns : SnapshotBlockMode::kPacked));
+  append_varint(out, base);
+  if (use_runs) {
+    append_varint(out, num_runs);
+    out += runs;
+    return;
+  }
+  out.push_back(static_cast<char>(width));
+  std::vector<uint64_t> words(packed_bytes / sizeof(uint64_t), 0);
+  for (size_t i = 0; i < count && width > 0; ++i) {
+    uint64_t offset = loads[i] - base;
+    uint64_t bit = i * width;
+    words[bit / 64] |= offset << (bit % 64);
+    if (bit % 64 + width > 64) {
+      words[bit / 64 + 1] |= offset >> (64 - bit % 64);
+    }
+  }
+  out.append(reinterpret_cast<const char*>(words.data()), packed_bytes);
+}
+
+}  // namespace internal
+
+/* Writes a snapshot of the loads, encoding one block at a time so that
+   only a block (rather than the load vector) is ever copied. The file is
+   first written to "<path>.tmp" and then renamed. */
+template<typename Load>
+void write_snapshot(
+  const std::string& path,
+  const Load* loads,
+  uint64_t num_bins,
+  uint64_t total_balls,
+  uint64_t max_load,
+  uint32_t block_size = 4'096) {
+  SnapshotHeader header;
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.block_size = block_size;
+  header.num_bins = num_bins;
+  header.total_balls = total_balls;
+  header.max_load = max_load;
+  header.num_blocks = (num_bins + block_size - 1) / block_size;
+  header.index_offset = 0;
+
+  std::string temporary_path = path + ".tmp";
+  std::FILE* file = std::fopen(temporary_path.c_str(), "wb");
+  if (file == nullptr) throw std::runtime_error("Failed to open snapshot " + temporary_path);
+  std::fwrite(&header, sizeof(header), 1, file);
+  std::vector<uint64_t> index;
+  index.reserve(header.num_blocks + 1);
+  uint64_t offset = sizeof(header);
+  std::string block;
+  for (uint64_t start = 0; start < num_bins; start += block_size) {
+    block.clear();
+    internal::encode_snapshot_block(loads + start, std::min<uint64_t>(block_size, num_bins - start), block);
+    std::fwrite(block.data(), 1, block.size(), file);
+    index.push_back(offset);
+    offset += block.size();
+  }
+  index.push_back(offset);
+  header.index_offset = offset;
+  std::fwrite(index.data(), sizeof(uint64_t), index.size(), file);
+  std::fseek(file, 0, SEEK_SET);
+  std::fwrite(&header, sizeof(header), 1, file);
+  bool failed = std::ferror(file) != 0;
+  failed |= std::fclose(file) != 0;
+  if (failed) throw std::runtime_error("Failed to write snapshot " + temporary_path);
+  std::remove(path.c_str());
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Failed to rename snapshot to " + path);
+  }
+}
+
+/* Random-access reader of a snapshot file, which is memory mapped where
+   supported. */
+class SnapshotReader {
+public:
+
+  explicit SnapshotReader(const std::string& path) : file_(path) {
+    if (file_.size() < sizeof(header_)) throw std::runtime_error("Truncated snapshot " + path);
+    std::memcpy(&header_, file_.data(), sizeof(header_));
+    if (std::memcmp(header_.magic, kSnapshotMagic, sizeof(header_.magic)) != 0 || header_.version != kSnapshotVersion) {
+      throw std::runtime_error("Not a snapshot file " + path);
+    }
+    if (header_.block_size == 0 || header_.index_offset + (header_.num_blocks + 1) * sizeof(uint64_t) > file_.size()) {
+      throw std::runtime_error("Truncated snapshot " + path);
+    }
+  }
+
+  const SnapshotHeader& getHeader() const {
+    return header_;
+  }
+
+  /* Returns the number of bins in the given block. */
+  size_t getBlockLength(uint64_t block) const {
+    return std::min<uint64_t>(header_.block_size, header_.num_bins - block * header_.block_size);
+  }
+
+  /* Decodes the loads of the given block into `out`, which must have room
+     for `getBlockLength(block)` loads. */
+  void decodeBlock(uint64_t block, uint64_t* out) const {
+    const char* in = blockBegin(block);
+    const char* end = blockBegin(block + 1);
+    size_t count = getBlockLength(block);
+    SnapshotBlockMode mode = static_cast<SnapshotBlockMode>(*in++);
+    uint64_t base = internal::read_varint(in, end);
+    if (mode == SnapshotBlockMode::kRuns) {
+      uint64_t num_runs = internal::read_varint(in, end);
+      size_t position = 0;
+      for (uint64_t run = 0; run < num_runs; ++run) {
+        uint64_t load = base + internal::read_varint(in, end);
+        uint64_t length = internal::read_varint(in, end);
+        if (position + length > count) throw std::runtime_error("Corrupted snapshot block.");
+        std::fill(out + position, out + position + length, load);
+        position += length;
+      }
+      return;
+    }
+    unsigned width = static_cast<unsigned char>(*in++);
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = base + internal::unpack(in, i, width);
+    }
+  }
+
+  /* Returns the load of a single bin, decoding only what is needed. */
+  uint64_t getLoad(uint64_t bin) const {
+    uint64_t block = bin / header_.block_size;
+    const char* in = blockBegin(block);
+    const char* end = blockBegin(block + 1);
+    if (static_cast<SnapshotBlockMode>(*in) == SnapshotBlockMode::kPacked) {
+      ++in;
+      uint64_t base = internal::read_varint(in, end);
+      unsigned width = static_cast<unsigned char>(*in++);
+      return base + internal::unpack(in, bin % header_.block_size, width);
+    }
+    std::vector<uint64_t> loads(getBlockLength(block));
+    decodeBlock(block, loads.data());
+    return loads[bin % header_.block_size];
+  }
+
+  /* Calls `visit(bin, load)` for every bin in order, decoding one block at
+     a time. */
+  template<typename Visit>
+  void forEach(Visit visit) const {
+    std::vector<uint64_t> loads(header_.block_size);
+    for (uint64_t block = 0; block < header_.num_blocks; ++block) {
+      decodeBlock(block, loads.data());
+      uint64_t first = block * header_.block_size;
+      for (size_t i = 0; i < getBlockLength(block); ++i) {
+        visit(first + i, loads[i]);
+      }
+    }
+  }
+
+private:
+
+  /* Returns the start of the encoding of the block. */
+  const char* blockBegin(uint64_t block) const {
+    uint64_t offset;
+    std::memcpy(&offset, file_.data() + header_.index_offset + block * sizeof(uint64_t), sizeof(offset));
+    return file_.data() + offset;
+  }
+
+  const MappedFile file_;
+  SnapshotHeader header_;
+};
+
+#endif  // NOISE22_SNAPSHOT_H_
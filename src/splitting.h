@@ -0,0 +1,216 @@
+/* Multilevel splitting estimator for the probability that the gap of a
+   process exceeds a large value. */
+#ifndef NOISE22_SPLITTING_H_
+#define NOISE22_SPLITTING_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "branching.h"
+#include "load_view.h"
+
+/* Options for the fixed-effort splitting estimator. */
+struct SplittingOptions {
+  /* Increasing thresholds of the score, where the last one is the target. */
+  std::vector<double> levels;
+
+  /* Number of trajectories started from the entrance states of each level. */
+  size_t trajectories_per_level = 1'000;
+
+  /* Number of rounds in the observation window. */
+  uint64_t horizon = 1;
+
+  /* Number of rounds between consecutive evaluations of the score. */
+  uint64_t check_interval = 1;
+
+  /* If set, the target event is that the score is at least the last level
+     at the end of the window (after crossing all intermediate levels),
+     otherwise it is that the score reaches the last level at some check
+     within the window. */
+  bool measure_at_horizon = false;
+};
+
+/* Result of the splitting estimator. */
+struct SplittingResult {
+  /* Estimate of the probability of the target event. */
+  double probability;
+
+  /* Estimated conditional probabilities of reaching each level. */
+  std::vector<double> level_probabilities;
+
+  /* Approximate relative standard error of the estimate (ignoring the
+     dependence between trajectories started from the same state). */
+  double relative_error;
+
+  /* Total number of rounds simulated. */
+  uint64_t rounds;
+};
+
+/* Returns the natural logarithm of the exponential potential
+     Phi = sum_i exp(alpha * (y_i - t/n)),
+   which can be used as a smoother score than the gap. This takes O(n) time,
+   so it should be used with a `check_interval` of Omega(n) balls. */
+template<typename Process>
+double log_exponential_potential(const Process& process, double alpha) {
+  LoadView load_vector = process.getLoadView();
+  // Factor out the maximum term to avoid overflows.
+  double sum = 0.0;
+  for (auto load : load_vector) {
+    sum += std::exp(alpha * (double(load) - process.getMaxLoad()));
+  }
+  return std::log(sum) + alpha * process.getGap();
+}
+
+/* Estimates the probability that the score of a process started from the
+   state `initial` crosses the last of the `levels` within `horizon` rounds,
+   using fixed-effort multilevel splitting.
+
+   In stage k, `trajectories_per_level` copies of the process are started
+   from the states in which earlier trajectories first crossed level k - 1
+   (cycling through them), each continuing with an independent random stream
+   and the remaining time of its window. The fraction of them that cross
+   level k estimates the conditional probability p_k and the estimate is the
+   product of the p_k. Since each copy only needs to cross one more level,
+   events with probability 10^-9 are estimated with a few thousand
+   trajectories per level if the levels are chosen so that p_k ~ 0.1-0.5.
+
+   An entrance whose score already reaches level k (e.g., after a round
+   that increased the gap by several levels, or at the end of the window)
+   counts as crossing it without further steps.
+
+   Trajectories are branched with `clone()`, which shares large load vectors
+   copy-on-write, so the entrances only hold the pages in which they
+   diverged. The score is any function of the process (e.g., its gap). The
+   estimate is conditional on `initial`, see `average_estimates` for
+   averaging over several starting states. */
+template<typename Process, typename Generator, typename Score>
+SplittingResult estimate_exceedance(
+  const Process& initial,
+  Generator& generator,
+  const SplittingOptions& options,
+  Score score) {
+  // A branch of a trajectory at the time it crossed the previous level.
+  struct Entrance {
+    Process process;
+    uint64_t elapsed;
+  };
+  SplittingResult result = { 1.0, {}, 0.0, 0 };
+  std::vector<Entrance> entrances;
+  entrances.push_back({ initial.clone(), 0 });
+  double squared_relative_error = 0.0;
+  for (size_t level = 0; level < options.levels.size(); ++level) {
+    bool last = level + 1 == options.levels.size();
+    double threshold = options.levels[level];
+    bool at_horizon = last && options.measure_at_horizon;
+    // Whether each entrance already has a score of at least the threshold.
+    std::vector<bool> reached;
+    for (const Entrance& entrance : entrances) {
+      reached.push_back((!at_horizon || entrance.elapsed == options.horizon) && score(entrance.process) >= threshold);
+    }
+    std::vector<Entrance> next_entrances;
+    for (size_t i = 0; i < options.trajectories_per_level; ++i) {
+      const Entrance& start = entrances[i % entrances.size()];
+      Entrance branch = { start.process.clone(), start.elapsed };
+      if (reached[i % entrances.size()]) {
+        next_entrances.push_back(std::move(branch));
+        continue;
+      }
+      Generator stream = branch_generator(generator);
+      bool crossed = false;
+      while (branch.elapsed < options.horizon) {
+        uint64_t steps = std::min(options.check_interval, options.horizon - branch.elapsed);
+        for (uint64_t step = 0; step < steps; ++step) {
+          branch.process.nextRound(stream);
+        }
+        branch.elapsed += steps;
+        result.rounds += steps;
+        if (at_horizon) continue;
+        if (score(branch.process) >= threshold) {
+          crossed = true;
+          break;
+        }
+      }
+      if (at_horizon) {
+        crossed = score(branch.process) >= threshold;
+      }
+      if (crossed) {
+        next_entrances.push_back(std::move(branch));
+      }
+    }
+    double p = next_entrances.size() / double(options.trajectories_per_level);
+    result.level_probabilities.push_back(p);
+    result.probability *= p;
+    if (p == 0.0) break;
+    squared_relative_error += (1.0 - p) / (p * options.trajectories_per_level);
+    entrances = std::move(next_entrances);
+  }
+  result.relative_error = std::sqrt(squared_relative_error);
+  return result;
+}
+
+/* Estimates the same probability as `estimate_exceedance` by naive Monte
+   Carlo, i.e., the fraction of `runs` independent continuations of
+   `initial` in which the score crosses the last level (for checking the
+   splitting estimate where the probability is not too small). */
+template<typename Process, typename Generator, typename Score>
+SplittingResult estimate_exceedance_naively(
+  const Process& initial,
+  Generator& generator,
+  const SplittingOptions& options,
+  Score score,
+  size_t runs) {
+  SplittingResult result = { 0.0, {}, 0.0, 0 };
+  double threshold = options.levels.back();
+  size_t hits = 0;
+  for (size_t run = 0; run < runs; ++run) {
+    Process process = initial.clone();
+    Generator stream = branch_generator(generator);
+    bool crossed = !options.measure_at_horizon && score(process) >= threshold;
+    for (uint64_t elapsed = 0; !crossed && elapsed < options.horizon; ) {
+      uint64_t steps = std::min(options.check_interval, options.horizon - elapsed);
+      for (uint64_t step = 0; step < steps; ++step) {
+        process.nextRound(stream);
+      }
+      elapsed += steps;
+      result.rounds += steps;
+      if (!options.measure_at_horizon) crossed = score(process) >= threshold;
+    }
+    if (options.measure_at_horizon) crossed = score(process) >= threshold;
+    if (crossed) ++hits;
+  }
+  result.probability = hits / double(runs);
+  result.level_probabilities.push_back(result.probability);
+  result.relative_error = hits == 0
+    ? std::numeric_limits<double>::infinity()
+    : std::sqrt((1.0 - result.probability) / hits);
+  return result;
+}
+
+/* Averages the estimates from several (independent) starting states, e.g.,
+   stationary states taken far apart on one trajectory, which estimates the
+   unconditional probability. The relative error is the standard error of
+   the mean over the starting states (or the error of the only estimate). */
+inline SplittingResult average_estimates(const std::vector<SplittingResult>& estimates) {
+  SplittingResult result = { 0.0, {}, 0.0, 0 };
+  for (const auto& estimate : estimates) {
+    result.probability += estimate.probability / estimates.size();
+    result.rounds += estimate.rounds;
+  }
+  if (estimates.size() == 1) {
+    result.level_probabilities = estimates[0].level_probabilities;
+    result.relative_error = estimates[0].relative_error;
+    return result;
+  }
+  double sum_of_squares = 0.0;
+  for (const auto& estimate : estimates) {
+    sum_of_squares += (estimate.probability - result.probability) * (estimate.probability - result.probability);
+  }
+  double standard_error = std::sqrt(sum_of_squares / (estimates.size() - 1) / estimates.size());
+  result.relative_error = result.probability > 0.0 ? standard_error / result.probability : std::numeric_limits<double>::infinity();
+  return result;
+}
+
+#endif  // NOISE22_SPLITTING_H_
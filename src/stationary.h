@@ -0,0 +1,201 @@
+/* Helpers for estimating the stationary gap distribution of a process from
+   a single long trajectory. */
+#ifndef NOISE22_STATIONARY_H_
+#define NOISE22_STATIONARY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "statistics.h"
+
+/* Runs the process for `warmup_rounds` rounds and then records its gap
+   every `interval_rounds` rounds until `num_samples` samples are collected.
+
+   The process is any of the processes in this repository, i.e., it provides
+   `nextRound(generator)` and `getGap()`. After taking each sample, this
+   calls `on_sample(index, process)` (e.g., to save a snapshot). */
+template<typename Process, typename Generator, typename OnSample>
+std::vector<double> sample_stationary(
+  Process& process,
+  Generator& generator,
+  uint64_t warmup_rounds,
+  uint64_t interval_rounds,
+  size_t num_samples,
+  OnSample on_sample) {
+  std::vector<double> gaps;
+  gaps.reserve(num_samples);
+  for (uint64_t round = 0; round < warmup_rounds; ++round) {
+    process.nextRound(generator);
+  }
+  for (size_t sample = 0; sample < num_samples; ++sample) {
+    for (uint64_t round = 0; round < interval_rounds; ++round) {
+      process.nextRound(generator);
+    }
+    gaps.push_back(process.getGap());
+    on_sample(sample, static_cast<const Process&>(process));
+  }
+  return gaps;
+}
+
+template<typename Process, typename Generator>
+std::vector<double> sample_stationary(
+  Process& process,
+  Generator& generator,
+  uint64_t warmup_rounds,
+  uint64_t interval_rounds,
+  size_t num_samples) {
+  return sample_stationary(process, generator, warmup_rounds, interval_rounds, num_samples, [](size_t, const Process&) {});
+}
+
+/* Online detector for the end of the burn-in phase of a trajectory.
+
+   It monitors the gap and the quadratic potential
+     Upsilon = sum_i (y_i - t/n)^2
+   sampled at regular intervals. A series is considered to have mixed once:
+     - the MSER-5 truncation point (the prefix whose removal minimises the
+       standard error of the remaining batch means) lies in the first half
+       of the series, and
+     - the Geweke statistic comparing the first 10% and the last 50% of the
+       truncated series (with variances corrected for autocorrelation) is
+       below 2 in absolute value.
+   The trajectory has mixed once both series have mixed and the mixing point
+   is the later of the two truncation points. */
+class BurnInDetector {
+public:
+
+  /* Initializes the detector, which will not declare a series mixed before
+     it has seen `min_samples` samples. */
+  explicit BurnInDetector(size_t min_samples = 40)
+    : min_samples_(std::max<size_t>(min_samples, 4 * kMserBatch)), mixed_(false), mixing_sample_(0) {
+
+  }
+
+  /* Adds the next sample of the trajectory and returns true if it has mixed. */
+  bool addSample(double gap, double quadratic_potential) {
+    if (mixed_) return true;
+    gaps_.push_back(gap);
+    potentials_.push_back(quadratic_potential);
+    if (gaps_.size() < min_samples_ || gaps_.size() % kMserBatch != 0) return false;
+    size_t gap_truncation, potential_truncation;
+    if (hasMixed(gaps_, gap_truncation) && hasMixed(potentials_, potential_truncation)) {
+      mixed_ = true;
+      mixing_sample_ = std::max(gap_truncation, potential_truncation);
+    }
+    return mixed_;
+  }
+
+  /* Returns true if the trajectory has been detected to have mixed. */
+  bool hasMixed() const {
+    return mixed_;
+  }
+
+  /* Returns the index of the first sample after the detected burn-in. */
+  size_t getMixingSample() const {
+    return mixing_sample_;
+  }
+
+  /* Returns the number of samples seen. */
+  size_t getNumSamples() const {
+    return gaps_.size();
+  }
+
+private:
+
+  /* Number of consecutive samples averaged in MSER-5. */
+  static constexpr size_t kMserBatch = 5;
+
+  /* Returns true if the series has mixed and sets `truncation` to the
+     number of samples in its burn-in. */
+  static bool hasMixed(const std::vector<double>& series, size_t& truncation) {
+    size_t num_batches = series.size() / kMserBatch;
+    std::vector<double> batch_means;
+    for (size_t b = 0; b < num_batches; ++b) {
+      batch_means.push_back(sample_mean(series, b * kMserBatch, (b + 1) * kMserBatch));
+    }
+    // MSER(d) = sum_{j >= d} (z_j - mean_d)^2 / (B - d)^2, using suffix sums.
+    double sum = 0.0, squares = 0.0, best = INFINITY;
+    size_t best_d = 0;
+    for (size_t d = num_batches; d-- > 0;) {
+      sum += batch_means[d];
+      squares += batch_means[d] * batch_means[d];
+      size_t remaining = num_batches - d;
+      if (remaining < 2) continue;
+      double mser = (squares - sum * sum / remaining) / (remaining * double(remaining));
+      if (mser <= best) {
+        best = mser;
+        best_d = d;
+      }
+    }
+    if (2 * best_d >= num_batches) return false;
+    truncation = best_d * kMserBatch;
+
+    std::vector<double> first(series.begin() + truncation, series.begin() + truncation + (series.size() - truncation) / 10);
+    std::vector<double> last(series.end() - (series.size() - truncation) / 2, series.end());
+    if (first.size() < 2) return false;
+    double z = (sample_mean(first, 0, first.size()) - sample_mean(last, 0, last.size()))
+      / std::sqrt(meanVariance(first) + meanVariance(last));
+    return std::isnan(z) || std::abs(z) < 2.0;
+  }
+
+  /* Returns the variance of the mean of the correlated series. */
+  static double meanVariance(const std::vector<double>& series) {
+    double mean = sample_mean(series, 0, series.size());
+    double squares = 0.0;
+    for (auto x : series) {
+      squares += (x - mean) * (x - mean);
+    }
+    return squares / (series.size() - 1) * integrated_autocorrelation_time(series) / series.size();
+  }
+
+  /* Minimum number of samples before the series can be declared mixed. */
+  const size_t min_samples_;
+
+  /* Samples of the gap and quadratic potential so far. */
+  std::vector<double> gaps_, potentials_;
+
+  /* Whether the trajectory has been detected to have mixed. */
+  bool mixed_;
+
+  /* Index of the first sample after the burn-in. */
+  size_t mixing_sample_;
+};
+
+/* Result of running the burn-in phase of a trajectory. */
+struct BurnInResult {
+  /* Number of rounds that were run. */
+  uint64_t rounds;
+  /* Detected number of rounds until the trajectory mixed. */
+  uint64_t mixing_rounds;
+  /* Whether the detector declared the trajectory mixed before `max_rounds`. */
+  bool mixed;
+};
+
+/* Runs the process until the detector declares it mixed, checking the gap
+   and quadratic potential every `check_interval` rounds, or until
+   `max_rounds` rounds have been run.
+
+   Computing the quadratic potential takes O(n) time, so `check_interval`
+   should correspond to Omega(n) balls. */
+template<typename Process, typename Generator>
+BurnInResult burn_in(
+  Process& process,
+  Generator& generator,
+  uint64_t check_interval,
+  uint64_t max_rounds,
+  BurnInDetector detector = BurnInDetector()) {
+  uint64_t rounds = 0;
+  while (rounds < max_rounds) {
+    uint64_t next_check = std::min(max_rounds, rounds + check_interval);
+    for (; rounds < next_check; ++rounds) {
+      process.nextRound(generator);
+    }
+    if (detector.addSample(process.getGap(), process.getQuadraticPotential())) {
+      return { rounds, detector.getMixingSample() * check_interval, true };
+    }
+  }
+  return { rounds, rounds, false };
+}
+
+#endif  // NOISE22_STATIONARY_H_
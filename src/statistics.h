@@ -0,0 +1,293 @@
+/* Estimators for summarising the gap samples collected by the experiments. */
+#ifndef NOISE22_STATISTICS_H_
+#define NOISE22_STATISTICS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/* A two-sided 95% confidence interval around a point estimate. */
+struct ConfidenceInterval {
+  double mean;
+  double lower;
+  double upper;
+};
+
+/* Method used to account for the correlation between consecutive samples
+   of a single trajectory. */
+enum class IntervalMethod {
+  /* Non-overlapping batch means over a fixed number of batches. */
+  kBatchMeans,
+  /* Variance inflated by the integrated autocorrelation time. */
+  kAutocorrelation
+};
+
+/* Returns the 97.5% quantile of the Student t-distribution with the given
+   degrees of freedom. */
+inline double student_t_quantile(size_t degrees_of_freedom) {
+  static const double kQuantiles[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+  if (degrees_of_freedom == 0) return std::numeric_limits<double>::infinity();
+  if (degrees_of_freedom <= 30) return kQuantiles[degrees_of_freedom - 1];
+  // Cornish-Fisher expansion around the normal quantile.
+  return 1.96 + 2.37 / degrees_of_freedom;
+}
+
+/* Returns the mean of the samples in [begin, end). */
+inline double sample_mean(const std::vector<double>& samples, size_t begin, size_t end) {
+  double sum = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    sum += samples[i];
+  }
+  return sum / (end - begin);
+}
+
+/* Returns the confidence interval for the mean of independent samples. */
+inline ConfidenceInterval iid_interval(const std::vector<double>& samples) {
+  size_t k = samples.size();
+  double mean = sample_mean(samples, 0, k);
+  double squares = 0.0;
+  for (auto x : samples) {
+    squares += (x - mean) * (x - mean);
+  }
+  double half_width = k < 2
+    ? std::numeric_limits<double>::infinity()
+    : student_t_quantile(k - 1) * std::sqrt(squares / (k - 1) / k);
+  return { mean, mean - half_width, mean + half_width };
+}
+
+/* Returns the batch means confidence interval for the mean of a correlated
+   sequence. The sequence is split into `num_batches` consecutive batches
+   (dropping the earliest samples if it does not divide evenly), which are
+   treated as independent if they are much longer than the correlation time. */
+inline ConfidenceInterval batch_means_interval(const std::vector<double>& samples, size_t num_batches = 20) {
+  size_t batch_size = samples.size() / num_batches;
+  if (batch_size == 0) {
+    batch_size = 1;
+    num_batches = samples.size();
+  }
+  size_t offset = samples.size() - batch_size * num_batches;
+  std::vector<double> batch_means;
+  for (size_t b = 0; b < num_batches; ++b) {
+    size_t begin = offset + b * batch_size;
+    batch_means.push_back(sample_mean(samples, begin, begin + batch_size));
+  }
+  return iid_interval(batch_means);
+}
+
+/* Returns the integrated autocorrelation time of the sequence, estimated
+   with Sokal's adaptive window (the smallest lag w with w >= 5 tau(w)). */
+inline double integrated_autocorrelation_time(const std::vector<double>& samples) {
+  size_t k = samples.size();
+  if (k < 2) return 1.0;
+  double mean = sample_mean(samples, 0, k);
+  double variance = 0.0;
+  for (auto x : samples) {
+    variance += (x - mean) * (x - mean);
+  }
+  variance /= k;
+  if (variance == 0.0) return 1.0;
+  double tau = 1.0;
+  for (size_t lag = 1; lag < k; ++lag) {
+    double covariance = 0.0;
+    for (size_t i = 0; i + lag < k; ++i) {
+      covariance += (samples[i] - mean) * (samples[i + lag] - mean);
+    }
+    tau += 2.0 * covariance / k / variance;
+    if (lag >= 5.0 * tau) break;
+  }
+  return std::max(tau, 1.0);
+}
+
+/* Returns the confidence interval for the mean of a correlated sequence,
+   using the variance of the mean inflated by the autocorrelation time. */
+inline ConfidenceInterval autocorrelation_interval(const std::vector<double>& samples) {
+  size_t k = samples.size();
+  double mean = sample_mean(samples, 0, k);
+  double variance = 0.0;
+  for (auto x : samples) {
+    variance += (x - mean) * (x - mean);
+  }
+  double half_width = k < 2
+    ? std::numeric_limits<double>::infinity()
+    : 1.96 * std::sqrt(variance / (k - 1) * integrated_autocorrelation_time(samples) / k);
+  return { mean, mean - half_width, mean + half_width };
+}
+
+/* Returns the confidence interval for the mean of a correlated sequence
+   using the given method. */
+inline ConfidenceInterval correlated_interval(const std::vector<double>& samples, IntervalMethod method) {
+  if (method == IntervalMethod::kBatchMeans) {
+    return batch_means_interval(samples);
+  }
+  return autocorrelation_interval(samples);
+}
+
+/* Returns the Wilson score interval for a proportion of `successes` out of
+   `trials`, which remains informative when the proportion is close to 0 or 1. */
+inline ConfidenceInterval wilson_interval(size_t successes, size_t trials) {
+  if (trials == 0) return { 0.0, 0.0, 1.0 };
+  const double z = 1.96;
+  double p = successes / double(trials);
+  double denominator = 1.0 + z * z / trials;
+  double centre = (p + z * z / (2.0 * trials)) / denominator;
+  double half_width = z * std::sqrt(p * (1.0 - p) / trials + z * z / (4.0 * trials * trials)) / denominator;
+  return { p, std::max(0.0, centre - half_width), std::min(1.0, centre + half_width) };
+}
+
+/* Streaming statistics of the (integer) gaps of the runs of a configuration.
+   It keeps the mean and variance using Welford's algorithm and a dense
+   histogram of the gaps, which spans the range of gaps seen so far. */
+class GapStatistics {
+public:
+
+  GapStatistics() : count_(0), mean_(0.0), squares_(0.0), min_gap_(0) {
+
+  }
+
+  /* Adds the gap of a run. */
+  void add(int gap) {
+    ++count_;
+    double delta = gap - mean_;
+    mean_ += delta / count_;
+    squares_ += delta * (gap - mean_);
+    extendRange(gap, gap);
+    ++counts_[gap - min_gap_];
+  }
+
+  /* Adds `runs` runs with the same gap in O(1) time. */
+  void add(int gap, size_t runs) {
+    if (runs == 0) return;
+    combine(runs, gap, 0.0);
+    extendRange(gap, gap);
+    counts_[gap - min_gap_] += runs;
+  }
+
+  /* Adds the runs of `other` (e.g., of another thread or shard). The
+     histograms are added entry by entry, which the compiler vectorizes. */
+  void merge(const GapStatistics& other) {
+    if (other.count_ == 0) return;
+    combine(other.count_, other.mean_, other.squares_);
+    extendRange(other.getMinGap(), other.getMaxGap());
+    size_t* counts = counts_.data() + (other.min_gap_ - min_gap_);
+    const size_t* other_counts = other.counts_.data();
+    for (size_t i = 0; i < other.counts_.size(); ++i) {
+      counts[i] += other_counts[i];
+    }
+  }
+
+  /* Returns the number of runs. */
+  size_t getCount() const {
+    return count_;
+  }
+
+  /* Returns the mean gap. */
+  double getMean() const {
+    return mean_;
+  }
+
+  /* Returns the sample variance of the gap. */
+  double getVariance() const {
+    return count_ < 2 ? 0.0 : squares_ / (count_ - 1);
+  }
+
+  /* Returns the confidence interval for the mean gap. */
+  ConfidenceInterval getMeanInterval() const {
+    double half_width = count_ < 2
+      ? std::numeric_limits<double>::infinity()
+      : student_t_quantile(count_ - 1) * std::sqrt(getVariance() / count_);
+    return { mean_, mean_ - half_width, mean_ + half_width };
+  }
+
+  /* Returns the smallest gap seen. */
+  int getMinGap() const {
+    return min_gap_;
+  }
+
+  /* Returns the largest gap seen. */
+  int getMaxGap() const {
+    return min_gap_ + int(counts_.size()) - 1;
+  }
+
+  /* Returns the number of runs with the given gap. */
+  size_t getGapCount(int gap) const {
+    if (gap < min_gap_ || gap > getMaxGap()) return 0;
+    return counts_[gap - min_gap_];
+  }
+
+  /* Returns the Wilson interval for the fraction of runs with the given gap. */
+  ConfidenceInterval getGapInterval(int gap) const {
+    return wilson_interval(getGapCount(gap), count_);
+  }
+
+  /* Returns the largest half-width of the intervals of the gaps seen. */
+  double getMaxGapHalfWidth() const {
+    double half_width = 0.0;
+    for (int gap = min_gap_; gap <= getMaxGap(); ++gap) {
+      ConfidenceInterval interval = getGapInterval(gap);
+      half_width = std::max(half_width, (interval.upper - interval.lower) / 2.0);
+    }
+    return half_width;
+  }
+
+private:
+
+  /* Adds `runs` runs with the given mean and sum of squared deviations to
+     the count, mean and variance (Chan et al.). */
+  void combine(size_t runs, double mean, double squares) {
+    size_t total = count_ + runs;
+    double delta = mean - mean_;
+    mean_ += delta * runs / total;
+    squares_ += squares + delta * delta * (double(count_) * runs / total);
+    count_ = total;
+  }
+
+  /* Extends the histogram to cover the gaps in [low, high]. */
+  void extendRange(int low, int high) {
+    if (counts_.empty()) {
+      min_gap_ = low;
+    } else if (low < min_gap_) {
+      counts_.insert(counts_.begin(), min_gap_ - low, 0);
+      min_gap_ = low;
+    }
+    if (high - min_gap_ >= int(counts_.size())) {
+      counts_.resize(high - min_gap_ + 1, 0);
+    }
+  }
+
+  /* Number of runs. */
+  size_t count_;
+
+  /* Running mean and sum of squared deviations (Welford). */
+  double mean_, squares_;
+
+  /* Smallest gap seen, which corresponds to the first entry of `counts_`. */
+  int min_gap_;
+
+  /* Number of runs with each gap in [min_gap_, min_gap_ + counts_.size()). */
+  std::vector<size_t> counts_;
+};
+
+/* Rule for deciding when a configuration has been run enough times. */
+struct SequentialStopping {
+  /* Target half-width for the Wilson interval of the fraction of runs with
+     each gap (e.g., 0.02 for +/-2%). If 0, then exactly `max_runs` are run. */
+  double precision = 0.0;
+
+  /* Bounds on the number of runs. */
+  size_t min_runs = 100;
+  size_t max_runs = 100;
+
+  /* Returns true if no more runs are needed. */
+  bool shouldStop(const GapStatistics& statistics) const {
+    size_t runs = statistics.getCount();
+    if (runs >= max_runs) return true;
+    if (runs < min_runs || precision <= 0.0) return false;
+    return statistics.getMaxGapHalfWidth() <= precision;
+  }
+};
+
+#endif  // NOISE22_STATISTICS_H_
@@ -0,0 +1,232 @@
+/* Binary traces of the bin samples of a process, for replaying identical
+   inputs to different deciders (or replaying logged choices).
+
+   A trace file consists of a `TraceHeader`, padding up to a multiple of
+   `kTraceAlignment` bytes, and then `num_samples` `TraceSample`s (the two
+   sampled bins of a ball). The samples are used directly from a read-only
+   memory mapping of the file, so a replay only streams through memory.
+
+   The deciders may also use randomness (noise, random tie-breaking), which
+   is not part of the trace: a replay draws it from a generator seeded with
+   the `noise_seed` of the trace, so replaying a trace with the same decider
+   is deterministic. */
+#ifndef NOISE22_TRACE_H_
+#define NOISE22_TRACE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+#include "numa.h"
+
+/* The two bins sampled for a ball. */
+struct TraceSample {
+  uint32_t i1;
+  uint32_t i2;
+};
+
+/* Fixed-size header of a trace file. */
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_bins;
+  uint64_t num_samples;
+  uint64_t noise_seed;
+  /* Offset of the samples from the beginning of the file. */
+  uint64_t samples_offset;
+};
+
+constexpr char kTraceMagic[8] = { 'N', 'O', 'I', 'S', 'E', '2', '2', 'Q' };
+constexpr uint32_t kTraceVersion = 1;
+constexpr uint64_t kTraceAlignment = 4096;
+
+/* Buffered writer of a trace file. */
+class TraceWriter {
+public:
+
+  TraceWriter(const std::string& path, uint64_t num_bins, uint64_t noise_seed) : path_(path) {
+    if (num_bins == 0 || num_bins - 1 > UINT32_MAX) {
+      throw std::runtime_error("Traces support between 1 and 2^32 bins.");
+    }
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) throw std::runtime_error("Failed to open trace " + path);
+    std::memcpy(header_.magic, kTraceMagic, sizeof(header_.magic));
+    header_.version = kTraceVersion;
+    header_.reserved = 0;
+    header_.num_bins = num_bins;
+    header_.num_samples = 0;
+    header_.noise_seed = noise_seed;
+    header_.samples_offset = kTraceAlignment;
+    std::vector<char> prefix(kTraceAlignment, 0);
+    std::fwrite(prefix.data(), 1, prefix.size(), file_);
+    buffer_.reserve(kBufferedSamples);
+  }
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  ~TraceWriter() {
+    if (file_ != nullptr) {
+      flush();
+      finish();
+    }
+  }
+
+  /* Appends the samples of a ball. */
+  void append(uint64_t i1, uint64_t i2) {
+    if (i1 >= header_.num_bins || i2 >= header_.num_bins) {
+      throw std::runtime_error("Trace sample out of range in " + path_);
+    }
+    buffer_.push_back({ uint32_t(i1), uint32_t(i2) });
+    if (buffer_.size() == kBufferedSamples) flush();
+  }
+
+  /* Writes the remaining samples and the final header. */
+  void close() {
+    flush();
+    if (!finish()) throw std::runtime_error("Failed to write trace " + path_);
+  }
+
+private:
+
+  static constexpr size_t kBufferedSamples = 1 << 16;
+
+  void flush() {
+    std::fwrite(buffer_.data(), sizeof(TraceSample), buffer_.size(), file_);
+    header_.num_samples += buffer_.size();
+    buffer_.clear();
+  }
+
+  /* Writes the header and closes the file, returning false on errors. */
+  bool finish() {
+    std::fseek(file_, 0, SEEK_SET);
+    std::fwrite(&header_, sizeof(header_), 1, file_);
+    bool failed = std::ferror(file_) != 0;
+    failed |= std::fclose(file_) != 0;
+    file_ = nullptr;
+    return !failed;
+  }
+
+  const std::string path_;
+  std::FILE* file_;
+  TraceHeader header_;
+  std::vector<TraceSample> buffer_;
+};
+
+/* Writes a trace of `num_samples` balls with two bins sampled uniformly at
+   random, as drawn by the processes. */
+template<typename Generator>
+void generate_trace(const std::string& path, uint64_t num_bins, uint64_t num_samples, uint64_t seed) {
+  Generator generator(seed);
+  std::uniform_int_distribution<uint64_t> uar(0, num_bins - 1);
+  TraceWriter writer(path, num_bins, generator());
+  for (uint64_t i = 0; i < num_samples; ++i) {
+    uint64_t i1 = uar(generator);
+    uint64_t i2 = uar(generator);
+    writer.append(i1, i2);
+  }
+  writer.close();
+}
+
+/* Zero-copy reader of a trace file. */
+class TraceReader {
+public:
+
+  explicit TraceReader(const std::string& path) : file_(path) {
+    if (file_.size() < sizeof(header_)) throw std::runtime_error("Truncated trace " + path);
+    std::memcpy(&header_, file_.data(), sizeof(header_));
+    if (std::memcmp(header_.magic, kTraceMagic, sizeof(header_.magic)) != 0 || header_.version != kTraceVersion) {
+      throw std::runtime_error("Not a trace file " + path);
+    }
+    if (header_.samples_offset + header_.num_samples * sizeof(TraceSample) > file_.size()) {
+      throw std::runtime_error("Truncated trace " + path);
+    }
+  }
+
+  const TraceHeader& getHeader() const {
+    return header_;
+  }
+
+  /* Returns the samples (without copying them). */
+  const TraceSample* getSamples() const {
+    return reinterpret_cast<const TraceSample*>(file_.data() + header_.samples_offset);
+  }
+
+  uint64_t size() const {
+    return header_.num_samples;
+  }
+
+private:
+
+  const MappedFile file_;
+  TraceHeader header_;
+};
+
+/* Throws if the process does not have as many bins as the trace. */
+template<typename Process>
+void check_trace_bins(const Process& process, const TraceReader& trace) {
+  if (process.getNumBins() != trace.getHeader().num_bins) {
+    throw std::runtime_error("The trace is for " + std::to_string(trace.getHeader().num_bins) + " bins.");
+  }
+}
+
+/* Replays the first `num_samples` samples of the trace into the process,
+   which must have as many bins as the trace. The process consumes them
+   with `replayRound(samples, noise)`, which returns the number of samples
+   used by the round; the replay stops before a round that would run past
+   `num_samples`. Returns the number of samples replayed. */
+template<typename Process, typename Generator>
+uint64_t replay_trace(Process& process, const TraceReader& trace, Generator& noise, uint64_t num_samples) {
+  check_trace_bins(process, trace);
+  num_samples = std::min(num_samples, trace.size());
+  const TraceSample* samples = trace.getSamples();
+  uint64_t position = 0;
+  while (position + process.getSamplesPerRound() <= num_samples) {
+    position += process.replayRound(samples + position, noise);
+  }
+  return position;
+}
+
+/* Replays the whole trace into each of the processes, in parallel on up to
+   `max_threads` threads. Each process draws its noise from a generator
+   seeded with the `noise_seed` of the trace. Since the trace is mapped
+   read-only, all threads share a single copy of it. The threads are pinned
+   with the `placement` policy, so the pages of each load vector are first
+   touched (and placed) by the node of the thread replaying into it. */
+template<typename Generator, typename Process>
+void replay_in_parallel(
+  std::vector<Process>& processes,
+  const TraceReader& trace,
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency()),
+  PlacementPolicy placement = thread_placement()) {
+  for (const auto& process : processes) {
+    check_trace_bins(process, trace);
+  }
+  std::atomic<size_t> next(0);
+  size_t num_threads = std::min(max_threads, processes.size());
+  auto worker = [&](size_t thread) {
+    pin_worker_thread(placement, thread, num_threads);
+    for (size_t i = next++; i < processes.size(); i = next++) {
+      Generator noise(trace.getHeader().noise_seed);
+      replay_trace(processes[i], trace, noise, trace.size());
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back(worker, t);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+#endif  // NOISE22_TRACE_H_
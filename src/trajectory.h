@@ -0,0 +1,355 @@
+/* Low-overhead recording of the trajectory of a process (its maximum load
+   over time, and optionally the number of bins near the maximum), for
+   plotting the gap against the number of balls.
+
+   The simulation thread only copies a few counters into a lock-free
+   single-producer single-consumer ring buffer at the sampling points. A
+   background thread drains the buffer, compresses the samples and writes
+   them to a file, so the simulation never waits for the disk.
+
+   A trajectory file consists of a `TrajectoryHeader` followed by one record
+   per sample, each field encoded as a (zig-zag) LEB128 varint of its
+   difference to the previous sample. Since consecutive samples differ by a
+   few balls of maximum load, most samples take 3-4 bytes. */
+#ifndef NOISE22_TRAJECTORY_H_
+#define NOISE22_TRAJECTORY_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "progress.h"
+
+/* Maximum number of levels below the maximum load whose bins are counted. */
+constexpr size_t kMaxTrajectoryLevels = 16;
+
+/* A sample of the trajectory of a process. */
+struct TrajectorySample {
+  uint64_t total_balls;
+  uint64_t max_load;
+  /* Number of bins with load max_load - k, for k < the recorded levels. */
+  uint64_t level_counts[kMaxTrajectoryLevels];
+
+  /* Returns the gap at the time of the sample. */
+  double getGap(uint64_t num_bins) const {
+    return max_load - total_balls / double(num_bins);
+  }
+};
+
+/* Fixed-capacity lock-free ring buffer for one producer and one consumer
+   thread. The capacity must be a power of two. */
+template<typename T>
+class SpscRing {
+public:
+
+  explicit SpscRing(size_t capacity) : slots_(capacity), mask_(capacity - 1), head_(0), tail_(0) {
+    if (capacity == 0 || (capacity & mask_) != 0) {
+      throw std::runtime_error("Ring buffer capacity must be a power of two.");
+    }
+  }
+
+  /* Adds an element, returning false if the buffer is full. (Producer) */
+  bool tryPush(const T& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size()) return false;
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* Removes the oldest element, returning false if the buffer is empty.
+     (Consumer) */
+  bool tryPop(T& value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  /* Indices of the next element to pop and push, on separate cache lines
+     so that the two threads do not contend on them. */
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+/* Spacing of the sampling points of a trajectory. */
+enum class RecordSchedule {
+  /* Every `interval` balls. */
+  kLinear,
+  /* At `interval` balls and then every time the number of balls has grown
+     by a factor of `growth`, which spreads the samples evenly on a
+     logarithmic axis. */
+  kLogarithmic
+};
+
+/* Options for recording a trajectory. */
+struct RecorderOptions {
+  RecordSchedule schedule = RecordSchedule::kLinear;
+
+  /* Number of balls between samples (or of the first sample). */
+  uint64_t interval = 1;
+
+  /* Growth factor of the number of balls between logarithmic samples. */
+  double growth = 1.1;
+
+  /* Number of levels below the maximum load whose bins are counted at each
+     sample (at most `kMaxTrajectoryLevels`). This takes O(n) time per
+     sample, so it is 0 by default. */
+  size_t levels = 0;
+
+  /* Capacity of the ring buffer in samples. */
+  size_t buffer_capacity = 1 << 14;
+};
+
+/* Header of a trajectory file. */
+struct TrajectoryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t levels;
+  uint64_t num_bins;
+};
+
+constexpr char kTrajectoryMagic[8] = { 'N', 'O', 'I', 'S', 'E', '2', '2', 'T' };
+constexpr uint32_t kTrajectoryVersion = 1;
+
+namespace internal {
+
+inline void put_varint(std::vector<unsigned char>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<unsigned char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+inline void put_signed_varint(std::vector<unsigned char>& out, int64_t value) {
+  put_varint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+inline bool get_varint(const unsigned char*& in, const unsigned char* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; in != end && shift < 64; shift += 7) {
+    unsigned char byte = *in++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+inline bool get_signed_varint(const unsigned char*& in, const unsigned char* end, int64_t& value) {
+  uint64_t encoded;
+  if (!get_varint(in, end, encoded)) return false;
+  value = int64_t(encoded >> 1) ^ -int64_t(encoded & 1);
+  return true;
+}
+
+}  // namespace internal
+
+/* Samples the trajectory of a process into a file. Call `observe(process)`
+   after every round: it only compares the number of balls to the next
+   sampling point, and otherwise hands a sample to the writer thread. */
+class TrajectoryRecorder {
+public:
+
+  TrajectoryRecorder(const std::string& path, uint64_t num_bins, const RecorderOptions& options = RecorderOptions())
+    : options_(options), next_sample_(std::max<uint64_t>(1, options.interval)),
+      ring_(options.buffer_capacity), done_(false), stalls_(0) {
+    if (options_.levels > kMaxTrajectoryLevels) {
+      throw std::runtime_error("At most " + std::to_string(kMaxTrajectoryLevels) + " levels can be recorded.");
+    }
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) throw std::runtime_error("Failed to open trajectory file " + path);
+    TrajectoryHeader header;
+    std::memcpy(header.magic, kTrajectoryMagic, sizeof(header.magic));
+    header.version = kTrajectoryVersion;
+    header.levels = uint32_t(options_.levels);
+    header.num_bins = num_bins;
+    std::fwrite(&header, sizeof(header), 1, file_);
+    writer_ = std::thread(&TrajectoryRecorder::drain, this);
+  }
+
+  TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+  TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+  ~TrajectoryRecorder() {
+    finish();
+  }
+
+  /* Records a sample if the process has reached the next sampling point. */
+  template<typename Process>
+  void observe(const Process& process) {
+    if (process.getTotalBalls() >= next_sample_) {
+      record(process);
+    }
+  }
+
+  /* Records a sample of the current state of the process. */
+  template<typename Process>
+  void record(const Process& process) {
+    TrajectorySample sample;
+    sample.total_balls = process.getTotalBalls();
+    sample.max_load = uint64_t(process.getMaxLoad());
+    if (options_.levels > 0) {
+      std::fill(sample.level_counts, sample.level_counts + options_.levels, 0);
+      for (auto load : process.getLoadView()) {
+        uint64_t depth = sample.max_load - uint64_t(load);
+        if (depth < options_.levels) ++sample.level_counts[depth];
+      }
+    }
+    // The writer only falls behind if the disk is much slower than the
+    // sampling rate, in which case the simulation has to wait for it.
+    while (!ring_.tryPush(sample)) {
+      ++stalls_;
+      std::this_thread::yield();
+    }
+    advance(sample.total_balls);
+  }
+
+  /* Waits for all samples to be written and closes the file. */
+  void close() {
+    if (!finish()) throw std::runtime_error("Failed to write trajectory file.");
+  }
+
+  /* Returns the number of times the simulation waited for the writer. */
+  uint64_t getStalls() const {
+    return stalls_;
+  }
+
+private:
+
+  /* Stops the writer and closes the file, returning false on write errors. */
+  bool finish() {
+    if (file_ == nullptr) return true;
+    done_.store(true, std::memory_order_release);
+    writer_.join();
+    bool failed = std::ferror(file_) != 0;
+    failed |= std::fclose(file_) != 0;
+    file_ = nullptr;
+    return !failed;
+  }
+
+  /* Moves the next sampling point past `total_balls`. */
+  void advance(uint64_t total_balls) {
+    while (next_sample_ <= total_balls) {
+      if (options_.schedule == RecordSchedule::kLinear) {
+        next_sample_ += std::max<uint64_t>(1, options_.interval);
+      } else {
+        next_sample_ = std::max(next_sample_ + 1, uint64_t(std::ceil(next_sample_ * options_.growth)));
+      }
+    }
+  }
+
+  /* Body of the writer thread. */
+  void drain() {
+    std::vector<unsigned char> encoded;
+    TrajectorySample previous = {};
+    TrajectorySample sample;
+    while (true) {
+      // Read `done_` before draining, so no sample pushed before it was set
+      // is missed.
+      bool done = done_.load(std::memory_order_acquire);
+      while (ring_.tryPop(sample)) {
+        internal::put_varint(encoded, sample.total_balls - previous.total_balls);
+        internal::put_signed_varint(encoded, int64_t(sample.max_load - previous.max_load));
+        for (size_t level = 0; level < options_.levels; ++level) {
+          internal::put_signed_varint(encoded, int64_t(sample.level_counts[level] - previous.level_counts[level]));
+        }
+        previous = sample;
+      }
+      if (!encoded.empty()) {
+        std::fwrite(encoded.data(), 1, encoded.size(), file_);
+        encoded.clear();
+      }
+      if (done) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  const RecorderOptions options_;
+
+  /* Number of balls at which the next sample is taken. */
+  uint64_t next_sample_;
+
+  SpscRing<TrajectorySample> ring_;
+  std::atomic<bool> done_;
+  uint64_t stalls_;
+  std::FILE* file_;
+  std::thread writer_;
+};
+
+/* Reads the samples of a trajectory file, together with its header. */
+inline std::vector<TrajectorySample> read_trajectory(const std::string& path, TrajectoryHeader& header) {
+  std::ifstream in(path, std::ios::binary);
+  std::vector<unsigned char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (contents.size() < sizeof(header)) throw std::runtime_error("Truncated trajectory file " + path);
+  std::memcpy(&header, contents.data(), sizeof(header));
+  if (std::memcmp(header.magic, kTrajectoryMagic, sizeof(header.magic)) != 0 || header.version != kTrajectoryVersion
+      || header.levels > kMaxTrajectoryLevels) {
+    throw std::runtime_error("Not a trajectory file " + path);
+  }
+  std::vector<TrajectorySample> samples;
+  TrajectorySample sample = {};
+  const unsigned char* in_ptr = contents.data() + sizeof(header);
+  const unsigned char* end = contents.data() + contents.size();
+  while (in_ptr != end) {
+    uint64_t balls;
+    int64_t max_load;
+    if (!internal::get_varint(in_ptr, end, balls) || !internal::get_signed_varint(in_ptr, end, max_load)) break;
+    sample.total_balls += balls;
+    sample.max_load += max_load;
+    bool complete = true;
+    for (size_t level = 0; level < header.levels && complete; ++level) {
+      int64_t count;
+      complete = internal::get_signed_varint(in_ptr, end, count);
+      sample.level_counts[level] += count;
+    }
+    // A truncated last sample (e.g., after a crash) is dropped.
+    if (!complete) break;
+    samples.push_back(sample);
+  }
+  return samples;
+}
+
+/* Runs the given number of rounds, passing the process to the recorder (if
+   not null) after every round and updating `progress` (if not null) after
+   every chunk of rounds. */
+template<typename Process, typename Generator>
+void run_recorded(
+  Process& process,
+  Generator& generator,
+  uint64_t rounds,
+  TrajectoryRecorder* recorder,
+  ProgressReporter* progress = nullptr) {
+  if (recorder == nullptr) {
+    run_with_progress(process, generator, rounds, progress);
+    return;
+  }
+  while (rounds > 0) {
+    uint64_t chunk = progress == nullptr ? rounds : std::min(rounds, kProgressChunk);
+    for (uint64_t round = 0; round < chunk; ++round) {
+      process.nextRound(generator);
+      recorder->observe(process);
+    }
+    rounds -= chunk;
+    if (progress != nullptr) progress->update(process.getTotalBalls());
+  }
+}
+
+#endif  // NOISE22_TRAJECTORY_H_
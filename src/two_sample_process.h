@@ -0,0 +1,205 @@
+/* The Two-Sample process of the noisy settings, with its decision function
+   given at runtime. */
+#ifndef NOISE22_TWO_SAMPLE_PROCESS_H_
+#define NOISE22_TWO_SAMPLE_PROCESS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "load_store.h"
+#include "load_view.h"
+#include "snapshot.h"
+#include "trace.h"
+
+/* Decides to which of the two sampled bins to allocate, given a view of
+   the load vector. The generator is passed by reference, so the noise
+   draws advance the stream of the process. */
+template<typename Generator>
+using DeciderFn = std::function<size_t(LoadView, size_t, size_t, Generator&)>;
+
+/* A process that makes two samples in each round and allocates 
+   according to a decision function to one of the two. The observer is
+   notified of every allocation. */
+template<typename Generator, typename Observer = NoObserver>
+class TwoSampleProcess {
+public:
+
+  /* Iniitializes the Two-Sample process. */
+  TwoSampleProcess(
+    size_t num_bins, 
+    const DeciderFn<Generator> decider,
+    const Observer& observer = Observer())
+    : decider_(decider), load_vector_(num_bins), uar_(0, num_bins - 1), max_load_(0), total_balls_(0), observer_(observer) {
+
+  }
+
+  /* Performs an allocation of a batch. */
+  void nextRound(Generator& generator) {
+    size_t i1 = uar_(generator);
+    size_t i2 = uar_(generator);
+    allocate(i1, i2, generator);
+  }
+
+  /* Allocates a ball with the two samples of a trace (instead of drawing
+     them), using `noise` for any randomness of the decider. Returns the
+     number of samples used. */
+  size_t replayRound(const TraceSample* samples, Generator& noise) {
+    allocate(samples->i1, samples->i2, noise);
+    return 1;
+  }
+
+  /* Returns the number of trace samples used by a round. */
+  size_t getSamplesPerRound() const {
+    return 1;
+  }
+
+  /* Returns the number of bins. */
+  size_t getNumBins() const {
+    return load_vector_.size();
+  }
+
+  /* Returns the current maximum load. */
+  size_t getMaxLoad() const {
+    return max_load_;
+  }
+
+  /* Returns the current gap. The integer part of the average load is
+     subtracted exactly, so the gap stays precise for any number of balls. */
+  double getGap() const {
+    size_t n = load_vector_.size();
+    return double(max_load_ - total_balls_ / n) - double(total_balls_ % n) / n;
+  }
+
+  /* Returns the gap rounded up, max load - floor(t/n), computed exactly. */
+  int64_t getGapCeiling() const {
+    return int64_t(max_load_ - total_balls_ / load_vector_.size());
+  }
+
+  /* Returns the gap rounded down, max load - ceil(t/n), computed exactly. */
+  int64_t getGapFloor() const {
+    size_t n = load_vector_.size();
+    return int64_t(max_load_ - (total_balls_ + n - 1) / n);
+  }
+
+  /* Returns the current load vector. */
+  std::vector<size_t> getLoadVector() const {
+    return std::vector<size_t>(load_vector_.begin(), load_vector_.end());
+  }
+
+  /* Returns a view of the current load vector (without copying it). */
+  LoadView getLoadView() const {
+    return LoadView(load_vector_);
+  }
+
+  /* Returns the observer of the process. */
+  const Observer& getObserver() const {
+    return observer_;
+  }
+
+  /* Empties the load vector, reusing its memory, so that the process can
+     be run again from the start. */
+  void reset() {
+    load_vector_.clear();
+    max_load_ = 0;
+    total_balls_ = 0;
+    observer_.onRestore(LoadView(load_vector_));
+  }
+
+  /* Returns an independent copy of the process in its current state,
+     whose load vector is shared copy-on-write if it is large (see
+     `LoadStore::clone`). The generator is not part of the state, see
+     `branch_generator` for continuing the copy with an independent random
+     stream. */
+  TwoSampleProcess clone() const {
+    return TwoSampleProcess(*this, decider_);
+  }
+
+  /* Returns a copy of the process in its current state, which continues
+     with a different decider (e.g., for a perturbed parameter). */
+  TwoSampleProcess clone(const DeciderFn<Generator> decider) const {
+    return TwoSampleProcess(*this, decider);
+  }
+
+  /* Saves the state of the process and of the generator to a checkpoint,
+     with the result of the burn-in detection that led to it (if any). */
+  void saveCheckpoint(const std::string& path, const Generator& generator, const BurnInResult& burn_in = { 0, 0, false }) const {
+    write_checkpoint(path, ProcessKind::kTwoSample, max_load_, total_balls_, 1, generator, load_vector_.data(), load_vector_.size(), burn_in);
+  }
+
+  /* Restores the state of the process and of the generator from a
+     checkpoint, so that the run resumes exactly. The decider is not part of
+     the checkpoint, so it must be the one the checkpoint was created with. */
+  void restoreCheckpoint(const CheckpointReader& checkpoint, Generator& generator) {
+    checkpoint.checkKind(ProcessKind::kTwoSample, load_vector_.size(), 1);
+    const uint64_t* loads = checkpoint.getLoads();
+    std::copy(loads, loads + load_vector_.size(), load_vector_.begin());
+    max_load_ = checkpoint.getHeader().max_load;
+    total_balls_ = checkpoint.getHeader().total_balls;
+    checkpoint.restoreGenerator(generator);
+    observer_.onRestore(LoadView(load_vector_));
+  }
+
+  /* Saves a compressed snapshot of the load vector (without copying it). */
+  void saveSnapshot(const std::string& path) const {
+    write_snapshot(path, load_vector_.data(), load_vector_.size(), total_balls_, max_load_);
+  }
+
+  /* Returns the total number of balls allocated. */
+  size_t getTotalBalls() const {
+    return total_balls_;
+  }
+
+  /* Returns the quadratic potential sum_i (y_i - t/n)^2 in O(n) time. */
+  double getQuadraticPotential() const {
+    double average = total_balls_ / double(load_vector_.size());
+    double potential = 0.0;
+    for (auto load : load_vector_) {
+      potential += (load - average) * (load - average);
+    }
+    return potential;
+  }
+
+private:
+
+  /* Allocates a ball to one of the two sampled bins. */
+  void allocate(size_t i1, size_t i2, Generator& generator) {
+    size_t idx = decider_(LoadView(load_vector_), i1, i2, generator);
+    ++load_vector_[idx];
+    ++total_balls_;
+    max_load_ = std::max(max_load_, load_vector_[idx]);
+    observer_.onAllocation(idx, load_vector_[idx] - 1, load_vector_[idx]);
+  }
+
+  /* Copies the state of `other` and replaces its decider. */
+  TwoSampleProcess(const TwoSampleProcess& other, const DeciderFn<Generator> decider)
+    : decider_(decider), load_vector_(other.load_vector_.clone()), uar_(other.uar_), max_load_(other.max_load_), total_balls_(other.total_balls_),
+      observer_(other.observer_) {
+
+  }
+
+  /* Functon that decides in which of the two sampled bins to allocate to. */
+  const DeciderFn<Generator> decider_;
+
+  /* Current load vector of the process. */
+  LoadStore<size_t> load_vector_;
+
+  /* Sample a bin uniformly at random. */
+  std::uniform_int_distribution<size_t> uar_;
+
+  /* Current maximum load in the load vector. */
+  size_t max_load_;
+
+  /* Total number of balls in the load vector. */
+  size_t total_balls_;
+
+  /* Observer of the allocations. */
+  Observer observer_;
+};
+
+#endif  // NOISE22_TWO_SAMPLE_PROCESS_H_